@@ -0,0 +1,233 @@
+/************************************************************************
+     File:        BlockSignals.cpp
+
+     Comment:     Keeping the trains of a Fleet apart
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+
+#include "BlockSignals.H"
+#include "Track.H"
+
+//****************************************************************************
+//
+// * Constructor - the cars are the ones the window draws
+//============================================================================
+BlockSignals::Params::
+Params()
+	: blockLength(40), movingBlock(false), brake(12), reaction(.5f), margin(5),
+	  driveSpeed(6), carLength(8), carGap(2), ridersPerCar(4)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void BlockSignals::Stats::
+reset()
+//============================================================================
+{
+	time = 0;
+	worstGap = 1e30f;
+	braking = 0;
+	dispatches = 0;
+	firstDispatch = lastDispatch = 0;
+	riders = 0;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+double BlockSignals::Stats::
+dispatchInterval() const
+//============================================================================
+{
+	if (dispatches < 2)
+		return 0;
+	return (lastDispatch - firstDispatch) / (dispatches - 1);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+double BlockSignals::Stats::
+ridersPerHour() const
+//============================================================================
+{
+	if (dispatches < 2 || lastDispatch <= firstDispatch)
+		return 0;
+	return riders * 3600 / (lastDispatch - firstDispatch);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void BlockSignals::
+setup(float _length)
+//============================================================================
+{
+	length = _length;
+	blocks = (params.blockLength > 0) ? (int)floorf(length / params.blockLength + .5f) : 1;
+	if (blocks < 1)
+		blocks = 1;
+	stats.reset();
+	lastS.clear();
+}
+
+//****************************************************************************
+//
+// * s can be off the end of the loop (or before the start) - the blocks
+//   carry on around
+//============================================================================
+float BlockSignals::
+blockStart(float s) const
+//============================================================================
+{
+	float b = length / blocks;
+	return floorf(s / b) * b;
+}
+
+//****************************************************************************
+//
+// * the leader of the last train in the order is the first one, once
+//   around the loop further on
+//============================================================================
+void BlockSignals::
+apply(Fleet& fleet, float dt, WorkPool& pool)
+//============================================================================
+{
+	size_t n = fleet.size();
+	stats.braking = 0;
+	if (n < 2 || length <= 0)
+		return;
+
+	order.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = std::make_pair(fleet.s[i], (int)i);
+	std::sort(order.begin(), order.end());
+
+	std::mutex merge;
+	int braking = 0;
+	float worst = stats.worstGap;
+	pool.parallelFor(n, fleet.grain, [&](size_t b, size_t e) {
+		int brakingHere = 0;
+		float worstHere = 1e30f;
+		for (size_t j = b; j < e; ++j) {
+			int f = order[j].second;
+			float nose = order[j].first;
+			float lead = (j + 1 < n) ? order[j + 1].first : order[0].first + length;
+			float tail = lead - trainLength(fleet.cars[order[(j + 1) % n].second]);
+
+			float gap = tail - nose;
+			if (gap < worstHere)
+				worstHere = gap;
+
+			float limit = params.movingBlock ? tail : blockStart(tail);
+			float room = limit - params.margin - nose;
+
+			float v = fleet.v[f];
+			float stop = v * params.reaction + v * v / (2 * params.brake);
+			if (v > 0 && stop <= room)
+				fleet.cap[f] = TrainPhysics::noCap;
+			else if (fleet.cap[f] < TrainPhysics::noCap && v < params.driveSpeed &&
+					 params.driveSpeed * params.reaction +
+					 params.driveSpeed * params.driveSpeed / (2 * params.brake) <= room) {
+				// the tires in the block push it back up to speed
+				fleet.cap[f] = TrainPhysics::noCap;
+				fleet.v[f] = params.driveSpeed;
+			}
+			else {
+				v -= params.brake * dt;
+				fleet.cap[f] = (v > 0) ? v : 0;
+				++brakingHere;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(merge);
+		braking += brakingHere;
+		if (worstHere < worst)
+			worst = worstHere;
+	});
+	stats.braking = braking;
+	stats.worstGap = worst;
+}
+
+//****************************************************************************
+//
+// * a train that went from the end of the loop to the start went past
+//   the station
+//============================================================================
+void BlockSignals::
+measure(const Fleet& fleet, float dt)
+//============================================================================
+{
+	stats.time += dt;
+
+	size_t n = fleet.size();
+	if (lastS.size() != n) {
+		lastS = fleet.s;
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		if (fleet.s[i] < lastS[i] - length / 2) {
+			if (stats.dispatches++)
+				stats.riders += fleet.cars[i] * params.ridersPerCar;
+			else
+				stats.firstDispatch = stats.time;
+			stats.lastDispatch = stats.time;
+		}
+		lastS[i] = fleet.s[i];
+	}
+}
+
+//****************************************************************************
+//
+// * the trains start out evenly spread, all at the same speed. the track
+//   has a hill, so they bunch up
+//============================================================================
+void
+reportSignals(size_t trains, double seconds)
+//============================================================================
+{
+	CTrack track;
+	track.points[1].pos.y += 30;
+	TrackCurve curve;
+	curve.build(track.points, TrackCurve::Cardinal);
+	TrainPhysics physics;
+	physics.lifts.push_back(TrainPhysics::Lift(0, 1));	// up the hill
+	physics.prepare(curve);
+
+	WorkPool pool;
+	const float dt = .01f;
+
+	printf("%lu trains on a loop %.0f long\n", (unsigned long)trains, physics.length);
+	printf("%14s %12s %14s %12s\n", "", "interval (s)", "riders/hour", "worst gap");
+	for (int moving = 0; moving < 2; ++moving) {
+		BlockSignals signals;
+		signals.params.movingBlock = moving != 0;
+		signals.setup(physics.length);
+
+		Fleet fleet;
+		fleet.place(trains, physics.length, 20);
+
+		for (double t = 0; t < seconds; t += dt) {
+			signals.apply(fleet, dt, pool);
+			fleet.step(physics, dt, pool);
+			signals.measure(fleet, dt);
+		}
+		printf("%14s %12.2f %14.0f %12.1f\n", moving ? "moving block" : "fixed blocks",
+			   signals.stats.dispatchInterval(), signals.stats.ridersPerHour(),
+			   signals.stats.worstGap);
+	}
+}
@@ -20,16 +20,17 @@
 *************************************************************************/
 #pragma once
 
-#include <time.h>
 #include <math.h>
 
 #include "TrainWindow.H"
 #include "TrainView.H"
 #include "CallBacks.H"
+#include "TrackCache.H"
 
 #pragma warning(push)
 #pragma warning(disable:4312)
 #pragma warning(disable:4311)
+#include <Fl/Fl.H>
 #include <Fl/Fl_File_Chooser.H>
 #include <Fl/math.h>
 #pragma warning(pop)
@@ -41,10 +42,11 @@
 void resetCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
-	tw->m_Track.resetPoints();
+	CTrack fresh;
+	Simulation::Command c(Simulation::Command::SetPoints);
+	c.points = fresh.points;
+	tw->simulation.post(c);
 	tw->trainView->selectedCube = -1;
-	tw->m_Track.trainU = 0;
-	tw->damageMe();
 }
 
 //***************************************************************************
@@ -64,25 +66,10 @@ void damageCB(Fl_Widget*, TrainWindow* tw)
 void addPointCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
-	// get the number of points
-	size_t npts = tw->m_Track.points.size();
-	// the number for the new point
-	size_t newidx = (tw->trainView->selectedCube>=0) ? tw->trainView->selectedCube : 0;
-
-	// pick a reasonable location
-	size_t previdx = (newidx + npts -1) % npts;
-	Pnt3f npos = (tw->m_Track.points[previdx].pos + tw->m_Track.points[newidx].pos) * .5f;
-
-	tw->m_Track.points.insert(tw->m_Track.points.begin() + newidx,npos);
-
-	// make it so that the train doesn't move - unless its affected by this control point
-	// it should stay between the same points
-	if (ceil(tw->m_Track.trainU) > ((float)newidx)) {
-		tw->m_Track.trainU += 1;
-		if (tw->m_Track.trainU >= npts) tw->m_Track.trainU -= npts;
-	}
-
-	tw->damageMe();
+	// the new point goes in front of the selected one (or the first one),
+	// halfway from the one before it
+	int newidx = (tw->trainView->selectedCube>=0) ? tw->trainView->selectedCube : 0;
+	tw->simulation.post(Simulation::Command(Simulation::Command::AddPoint, newidx));
 }
 
 //***************************************************************************
@@ -92,13 +79,9 @@ void addPointCB(Fl_Widget*, TrainWindow* tw)
 void deletePointCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
-	if (tw->m_Track.points.size() > 4) {
-		if (tw->trainView->selectedCube >= 0) {
-			tw->m_Track.points.erase(tw->m_Track.points.begin() + tw->trainView->selectedCube);
-		} else
-			tw->m_Track.points.pop_back();
-	}
-	tw->damageMe();
+	// the selected one, or the last one if there is none
+	tw->simulation.post(Simulation::Command(Simulation::Command::DeletePoint,
+											tw->trainView->selectedCube));
 }
 //***************************************************************************
 //
@@ -106,8 +89,7 @@ void deletePointCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 void forwCB(Fl_Widget*, TrainWindow* tw)
 {
-	tw->advanceTrain(2);
-	tw->damageMe();
+	tw->simulation.post(Simulation::Command(Simulation::Command::MoveTrain, 0, 2));
 }
 //***************************************************************************
 //
@@ -116,31 +98,136 @@ void forwCB(Fl_Widget*, TrainWindow* tw)
 void backCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
-	tw->advanceTrain(-2);
+	tw->simulation.post(Simulation::Command(Simulation::Command::MoveTrain, 0, -2));
+}
+
+
+
+//***************************************************************************
+//
+// * Copy the shadow settings from the widgets into the shadow map
+//===========================================================================
+void shadowCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	tw->trainView->shadowMap.resolution = 512 << tw->shadowSize->value();
+	tw->trainView->shadowMap.pcfRadius = (int)tw->pcfRadius->value();
 	tw->damageMe();
 }
 
 
 
-static unsigned long lastRedraw = 0;
 //***************************************************************************
 //
-// * Callback for idling - if things are sitting, this gets called
-// if the run button is pushed, then we need to make the train go.
-// This is taken from the old "RunButton" demo.
-// another nice problem to have - most likely, we'll be too fast
-// don't draw more than 30 times per second
+// * The run button - the simulation thread runs the clock while it is down
+//   (and sleeps while it is up)
 //===========================================================================
-void runButtonCB(TrainWindow* tw)
+void runButtonCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
-	if (tw->runButton->value()) {	// only advance time if appropriate
-		if (clock() - lastRedraw > CLOCKS_PER_SEC/30) {
-			lastRedraw = clock();
-			tw->advanceTrain();
-			tw->damageMe();
+	tw->simulation.post(Simulation::Command(Simulation::Command::SetRunning, 0,
+											tw->runButton->value() ? 1.0f : 0.0f));
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void speedCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	tw->simulation.post(Simulation::Command(Simulation::Command::SetSpeed, 0,
+											(float)tw->speed->value()));
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void splineCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	tw->simulation.post(Simulation::Command(Simulation::Command::SetSplineType,
+											tw->splineBrowser->value()));
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void physicsCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	tw->simulation.post(Simulation::Command(Simulation::Command::SetPhysics, 0,
+											tw->physics->value() ? 1.0f : 0.0f));
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void planCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	tw->simulation.post(Simulation::Command(Simulation::Command::SetPlanned, 0,
+											tw->plan->value() ? 1.0f : 0.0f));
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void recordCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	Simulation::Command c(Simulation::Command::Record);
+	if (tw->record->value()) {
+		const char* fname =
+			fl_input("File name for the recording","TrackFiles/run.rec");
+		if (!fname) {
+			tw->record->value(0);
+			return;
 		}
+		c.value = 1;
+		c.name = fname;
 	}
+	tw->simulation.post(c);
+}
+
+//***************************************************************************
+//
+// * A new snapshot is out. This runs on the simulation thread, so all it
+//   may do is ask FlTk to redraw on the user interface thread
+//===========================================================================
+void simulationCB(TrainWindow* tw)
+//===========================================================================
+{
+	Fl::awake((Fl_Awake_Handler)redrawCB, tw);
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void redrawCB(TrainWindow* tw)
+//===========================================================================
+{
+	tw->damageMe();
+}
+
+//***************************************************************************
+//
+// * A load or save just started: put up the progress bar, and keep it
+//   moving until it is done
+//===========================================================================
+static void showIO(TrainWindow* tw, const char* what)
+//===========================================================================
+{
+	tw->ioProgress->label(what);
+	tw->ioProgress->value(0);
+	tw->ioProgress->show();
+	tw->ioCancel->show();
+	Fl::add_timeout(.1, (Fl_Timeout_Handler)ioTimerCB, tw);
 }
 
 //***************************************************************************
@@ -151,10 +238,13 @@ void loadCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
 	const char* fname = 
-		fl_file_chooser("Pick a Track File","*.txt","TrackFiles/track.txt");
+		fl_file_chooser("Pick a Track File (or a survey, *.csv)","*.{txt,trk,csv}","TrackFiles/track.txt");
 	if (fname) {
-		tw->m_Track.readPoints(fname);
-		tw->damageMe();
+		// the track being shown keeps going until the new one is in
+		if (tw->io.load(fname))
+			showIO(tw, "Loading");
+		else
+			fl_alert("Still busy with the last load or save");
 	}
 }
 //***************************************************************************
@@ -165,9 +255,148 @@ void saveCB(Fl_Widget*, TrainWindow* tw)
 //===========================================================================
 {
 	const char* fname = 
-		fl_input("File name for save (should be *.txt)","TrackFiles/");
-	if (fname)
-		tw->m_Track.writePoints(fname);
+		fl_input("File name for save (should be *.txt, or *.trk for binary)","TrackFiles/");
+	if (fname) {
+		// save what is on the screen
+		if (tw->io.save(fname, *tw->simulation.snapshot().points))
+			showIO(tw, "Saving");
+		else
+			fl_alert("Still busy with the last load or save");
+	}
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void ioTimerCB(TrainWindow* tw)
+//===========================================================================
+{
+	if (tw->io.busy()) {
+		tw->ioProgress->value(tw->io.progress());
+		Fl::repeat_timeout(.1, (Fl_Timeout_Handler)ioTimerCB, tw);
+	}
+}
+
+//***************************************************************************
+//
+// *
+//===========================================================================
+void cancelIOCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	tw->io.cancel();
+}
+
+//***************************************************************************
+//
+// * This runs on the loading thread - it can only pass it on
+//===========================================================================
+void ioNotifyCB(TrainWindow* tw)
+//===========================================================================
+{
+	Fl::awake((Fl_Awake_Handler)ioDoneCB, tw);
+}
+
+//***************************************************************************
+//
+// * A load or save is over. A load's points go to the simulation in one
+//   command, so it changes tracks all at once; a save's go back to it so
+//   its journal can start over from them. the file that was loaded or
+//   saved is the one to watch from then on (watching it again forgets the
+//   save's own writes, which aren't anything to reload)
+//===========================================================================
+void ioDoneCB(TrainWindow* tw)
+//===========================================================================
+{
+	std::vector<ControlPoint> points;
+	std::string why;
+	TrackIO::Job job = tw->io.finished(points, why);
+	if (job == TrackIO::None)
+		return;
+
+	Fl::remove_timeout((Fl_Timeout_Handler)ioTimerCB, tw);
+	tw->ioProgress->hide();
+	tw->ioCancel->hide();
+
+	if (!why.empty())
+		fl_alert(job == TrackIO::Reload ? "Couldn't reload the track: %s" : "%s", why.c_str());
+	else if (job == TrackIO::Reload && !points.empty()) {
+		// a reload is the same track, edited - the train stays put, and
+		// only the bits of the curve that moved are sampled again. it is
+		// an edit to the journal (index 1), not a new start, so if the
+		// edits here are thrown away for it they can still be got back
+		static bool asking = false;		// the question is up
+		static bool missed = false;		// and the file changed again meanwhile
+		static bool confirmed = false;	// the answer was reload, for this one
+		if (asking) {
+			missed = true;
+			return;
+		}
+		tw->simulation.fetch();
+		if (tw->simulation.snapshot().unsaved && !confirmed) {
+			asking = true;
+			int reload = fl_choice("The track file was changed by something else,\n"
+								   "and there are edits here that aren't saved.",
+								   "Keep my edits", "Reload the file", 0);
+			asking = false;
+			if (reload && missed) {
+				// what is here is old by now - read it again
+				missed = false;
+				confirmed = true;
+				reloadCB(tw);
+				return;
+			}
+			missed = false;
+			if (!reload)
+				return;
+		}
+		confirmed = false;
+		Simulation::Command c(Simulation::Command::SetPoints, 1, 1);
+		c.points.swap(points);
+		c.name = curveCacheName(tw->io.name().c_str());
+		tw->simulation.post(c);
+	}
+	else if (job == TrackIO::Load && !points.empty()) {
+		Simulation::Command c(Simulation::Command::SetPoints);
+		c.points.swap(points);
+		c.name = curveCacheName(tw->io.name().c_str());
+		tw->simulation.post(c);
+		tw->watch.watch(tw->io.name().c_str());
+	}
+	else if (job == TrackIO::Save && !points.empty()) {
+		Simulation::Command c(Simulation::Command::Saved);
+		c.points.swap(points);
+		c.name = curveCacheName(tw->io.name().c_str());
+		tw->simulation.post(c);
+		tw->watch.watch(tw->io.name().c_str());
+	}
+}
+
+//***************************************************************************
+//
+// * This runs on the watch's thread - it can only pass it on
+//===========================================================================
+void watchNotifyCB(TrainWindow* tw)
+//===========================================================================
+{
+	Fl::awake((Fl_Awake_Handler)reloadCB, tw);
+}
+
+//***************************************************************************
+//
+// * quietly - no progress bar for something the user didn't ask for
+//===========================================================================
+void reloadCB(TrainWindow* tw)
+//===========================================================================
+{
+	std::string file = tw->watch.file();
+	if (file.empty())
+		return;
+	if (!tw->io.reload(file.c_str())) {
+		Fl::remove_timeout((Fl_Timeout_Handler)reloadCB, tw);
+		Fl::add_timeout(.25, (Fl_Timeout_Handler)reloadCB, tw);
+	}
 }
 
 //***************************************************************************
@@ -177,14 +406,8 @@ void saveCB(Fl_Widget*, TrainWindow* tw)
 void rollx(TrainWindow* tw, float dir)
 {
 	int s = tw->trainView->selectedCube;
-	if (s >= 0) {
-		Pnt3f old = tw->m_Track.points[s].orient;
-		float si = sin(((float)M_PI_4) * dir);
-		float co = cos(((float)M_PI_4) * dir);
-		tw->m_Track.points[s].orient.y = co * old.y - si * old.z;
-		tw->m_Track.points[s].orient.z = si * old.y + co * old.z;
-	}
-	tw->damageMe();
+	if (s >= 0)
+		tw->simulation.post(Simulation::Command(Simulation::Command::RollX, s, dir));
 } 
 
 //***************************************************************************
@@ -214,18 +437,8 @@ void rollz(TrainWindow* tw, float dir)
 //===========================================================================
 {
 	int s = tw->trainView->selectedCube;
-	if (s >= 0) {
-
-		Pnt3f old = tw->m_Track.points[s].orient;
-
-		float si = sin(((float)M_PI_4) * dir);
-		float co = cos(((float)M_PI_4) * dir);
-
-		tw->m_Track.points[s].orient.y = co * old.y - si * old.x;
-		tw->m_Track.points[s].orient.x = si * old.y + co * old.x;
-	}
-
-	tw->damageMe();
+	if (s >= 0)
+		tw->simulation.post(Simulation::Command(Simulation::Command::RollZ, s, dir));
 }
 
 //***************************************************************************
@@ -248,3 +461,48 @@ void rmzCB(Fl_Widget*, TrainWindow* tw)
 	rollz(tw, -1);
 }
 
+//***************************************************************************
+//
+// * A branch goes through the loop's points (all but the first, which is
+//   where the switch is), pushed out sideways from the middle of the loop -
+//   a bit further for each branch there is already
+//===========================================================================
+void branchCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	std::shared_ptr<const std::vector<ControlPoint> > points =
+		tw->simulation.snapshot().points;
+	std::shared_ptr<const TrackNetwork> network = tw->simulation.snapshot().network;
+	if (!points || points->size() < 3 || !network)
+		return;
+
+	Pnt3f middle(0, 0, 0);
+	for (size_t i = 0; i < points->size(); ++i)
+		middle = middle + (*points)[i].pos;
+	middle = middle * (1.0f / points->size());
+
+	float out = 1 + .25f * network->edges.size();
+	Simulation::Command c(Simulation::Command::AddBranch);
+	for (size_t i = 1; i < points->size(); ++i) {
+		ControlPoint p = (*points)[i];
+		p.pos.x = middle.x + (p.pos.x - middle.x) * out;
+		p.pos.z = middle.z + (p.pos.z - middle.z) * out;
+		c.points.push_back(p);
+	}
+	tw->simulation.post(c);
+}
+
+//***************************************************************************
+//
+// * The switch at the start of the loop goes to the next way round
+//===========================================================================
+void switchCB(Fl_Widget*, TrainWindow* tw)
+//===========================================================================
+{
+	std::shared_ptr<const TrackNetwork> network = tw->simulation.snapshot().network;
+	if (!network || network->nodes.empty() || network->nodes[0].out.size() < 2)
+		return;
+	const TrackNetwork::Node& node = network->nodes[0];
+	tw->simulation.post(Simulation::Command(Simulation::Command::SetSwitch, 0,
+		(float)((node.outSetting + 1) % node.out.size())));
+}
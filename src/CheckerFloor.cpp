@@ -0,0 +1,108 @@
+/************************************************************************
+     File:        CheckerFloor.cpp
+
+     Comment:     The ground plane, drawn as one shaded quad
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <string>
+
+#include <windows.h>
+#include <glad/glad.h>
+
+#include "CheckerFloor.H"
+#include "ShadowMap.H"
+#include "Utilities/3DUtils.H"
+
+//****************************************************************************
+//
+// * the shader - "cell" is the position in units of squares, measured from
+//   the corner of the floor (that is where drawFloor starts counting)
+//============================================================================
+static const char* floorVS =
+	"#version 120\n"
+	"uniform vec2 origin;\n"
+	"uniform float cellSize;\n"
+	"varying vec2 cell;\n"
+	"varying vec4 eyePos;\n"
+	"void main() {\n"
+	"	cell = (gl_Vertex.xz - origin) / cellSize;\n"
+	"	eyePos = gl_ModelViewMatrix * gl_Vertex;\n"
+	"	gl_Position = ftransform();\n"
+	"}\n";
+
+// the checker is box filtered over the pixel footprint, otherwise the
+// squares turn into moire far away from the camera. shadows darken the
+// floor by half, like the old transparent black ones did.
+// (this goes after ShadowMap::pcfSource, which has the #version)
+static const char* floorFS =
+	"uniform vec3 color1;\n"
+	"uniform vec3 color2;\n"
+	"varying vec2 cell;\n"
+	"varying vec4 eyePos;\n"
+	"void main() {\n"
+	"	vec2 w = fwidth(cell) + 0.0001;\n"
+	"	vec2 i = 2.0 * (abs(fract((cell - 0.5 * w) * 0.5) - 0.5)\n"
+	"	              - abs(fract((cell + 0.5 * w) * 0.5) - 0.5)) / w;\n"
+	"	float odd = 0.5 - 0.5 * i.x * i.y;\n"
+	"	float lit = 0.5 + 0.5 * shadowFactor(eyePos);\n"
+	"	gl_FragColor = vec4(mix(color2, color1, odd) * lit, 1.0);\n"
+	"}\n";
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+CheckerFloor::
+CheckerFloor()
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void CheckerFloor::
+init()
+//============================================================================
+{
+	shader.invalidate();
+	shader.build(floorVS, (std::string(ShadowMap::pcfSource) + floorFS).c_str());
+}
+
+//****************************************************************************
+//
+// * draw the floor - one quad, the squares come from the shader.
+//   the shadow uniforms have to be set already (ShadowMap::bind)
+//============================================================================
+void CheckerFloor::
+draw(float size, int nSquares)
+//============================================================================
+{
+	float half = size / 2;
+
+	// if the shader didn't build, fall back to the old floor
+	if (!shader.valid()) {
+		drawFloor(size, nSquares);
+		return;
+	}
+
+	shader.use();
+	glUniform2f(shader.uniform("origin"), -half, -half);
+	glUniform1f(shader.uniform("cellSize"), size / ((float)nSquares));
+	glUniform3fv(shader.uniform("color1"), 1, floorColor1);
+	glUniform3fv(shader.uniform("color2"), 1, floorColor2);
+
+	glBegin(GL_QUADS);
+		glNormal3f(0, 1, 0);
+		glVertex3f(-half, 0, -half);
+		glVertex3f(-half, 0,  half);
+		glVertex3f( half, 0,  half);
+		glVertex3f( half, 0, -half);
+	glEnd();
+
+	glUseProgram(0);
+}
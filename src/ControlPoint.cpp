@@ -70,7 +70,7 @@ ControlPoint(const Pnt3f &_pos, const Pnt3f &_orient)
 // * Draw the control point
 //============================================================================
 void ControlPoint::
-draw()
+draw() const
 //============================================================================
 {
 	float size=2.0;
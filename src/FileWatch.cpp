@@ -0,0 +1,222 @@
+/************************************************************************
+     File:        FileWatch.cpp
+
+     Comment:     Noticing when a file is changed by something else
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <chrono>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "FileWatch.H"
+#include "SimClock.H"
+
+// how often the thread looks up (for quit, and to see if it has settled)
+static const int tickMs = 100;
+
+// enough of a file to see that it changed
+struct FileStamp {
+	bool operator!=(const FileStamp& o) const
+	{
+		return there != o.there || time != o.time || size != o.size;
+	}
+
+	bool		there;
+	long long	time;
+	long long	size;
+};
+
+static FileStamp stampOf(const std::string& filename)
+{
+	FileStamp s = { false, 0, 0 };
+	struct stat st;
+	if (!stat(filename.c_str(), &st)) {
+		s.there = true;
+		s.time = (long long)st.st_mtime;
+		s.size = (long long)st.st_size;
+	}
+	return s;
+}
+
+#ifdef __linux__
+//****************************************************************************
+//
+// * everything inotify has to say - true if any of it is about the file
+//============================================================================
+static bool readEvents(int fd, const std::string& base)
+{
+	bool mine = false;
+	alignas(struct inotify_event) char buffer[4096];
+	ssize_t n;
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (char* at = buffer; at < buffer + n; ) {
+			const struct inotify_event* e = (const struct inotify_event*)at;
+			if ((e->mask & IN_Q_OVERFLOW) || (e->len && base == e->name))
+				mine = true;
+			at += sizeof(struct inotify_event) + e->len;
+		}
+	}
+	return mine;
+}
+#endif
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+FileWatch::
+FileWatch()
+	: settle(.2), pollInterval(.5), quit(false), notify(0), notifyData(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+FileWatch::
+~FileWatch()
+//============================================================================
+{
+	stop();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void FileWatch::
+setNotify(void (*n)(void*), void* data)
+//============================================================================
+{
+	notify = n;
+	notifyData = data;
+}
+
+//****************************************************************************
+//
+// * a new thread for every file - the old one (and anything it saw) goes
+//============================================================================
+void FileWatch::
+watch(const char* name)
+//============================================================================
+{
+	stop();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		filename = name ? name : "";
+	}
+	if (!name || !*name)
+		return;
+	quit = false;
+	thread = std::thread(&FileWatch::run, this, std::string(name));
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+std::string FileWatch::
+file() const
+//============================================================================
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return filename;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void FileWatch::
+stop()
+//============================================================================
+{
+	if (!thread.joinable())
+		return;
+	quit = true;
+	thread.join();
+}
+
+//****************************************************************************
+//
+// * the watch's thread: wait for the file to change, then for it to stop
+//   changing
+//============================================================================
+void FileWatch::
+run(std::string name)
+//============================================================================
+{
+	std::string dir = ".", base = name;
+	size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos) {
+		dir = name.substr(0, slash ? slash : 1);
+		base = name.substr(slash + 1);
+	}
+
+	// without inotify (or if it won't watch this directory), look at the
+	// file every so often
+	int fd = -1;
+#ifdef __linux__
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd >= 0 && inotify_add_watch(fd, dir.c_str(),
+									 IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE) < 0) {
+		close(fd);
+		fd = -1;
+	}
+#endif
+
+	FileStamp last = stampOf(name);
+	double lastPoll = SimClock::now();
+	double changed = 0;
+	bool pending = false;
+	while (!quit) {
+		bool seen = false;
+#ifdef __linux__
+		if (fd >= 0) {
+			struct pollfd p = { fd, POLLIN, 0 };
+			if (poll(&p, 1, tickMs) > 0)
+				seen = readEvents(fd, base);
+		}
+		else
+#endif
+			std::this_thread::sleep_for(std::chrono::milliseconds(tickMs));
+
+		// while it is changing, look every tick, so it is seen to settle
+		double now = SimClock::now();
+		if (fd < 0 && (pending || now - lastPoll >= pollInterval)) {
+			lastPoll = now;
+			FileStamp s = stampOf(name);
+			if (s != last) {
+				last = s;
+				seen = true;
+			}
+		}
+
+		if (seen) {
+			pending = true;
+			changed = now;
+		}
+		else if (pending && now - changed >= settle) {
+			pending = false;
+			if (notify)
+				notify(notifyData);
+		}
+	}
+
+#ifdef __linux__
+	if (fd >= 0)
+		close(fd);
+#endif
+}
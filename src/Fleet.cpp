@@ -0,0 +1,133 @@
+/************************************************************************
+     File:        Fleet.cpp
+
+     Comment:     Lots of trains on one track
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <stdio.h>
+
+#include "Fleet.H"
+#include "SimClock.H"
+#include "Track.H"
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Fleet::
+Fleet()
+	: grain(2048)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Fleet::
+place(size_t n, float length, float speed, int _cars)
+//============================================================================
+{
+	edge.assign(n, 0);
+	s.resize(n);
+	v.assign(n, speed);
+	hint.assign(n, 0);
+	cap.assign(n, TrainPhysics::noCap);
+	cars.assign(n, (unsigned char)_cars);
+	for (size_t i = 0; i < n; ++i)
+		s[i] = length * i / n;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Fleet::
+step(const TrainPhysics& physics, float dt, WorkPool& pool)
+//============================================================================
+{
+	pool.parallelFor(size(), grain, [&](size_t b, size_t e) {
+		physics.step(dt, e - b, &s[b], &v[b], &hint[b], &cap[b]);
+	});
+}
+
+//****************************************************************************
+//
+// * the trains in each piece are stepped in runs on the same edge, then
+//   moved over the ends of their edges. one that runs into the end of a
+//   line stops there; one that goes on to another edge finds its sample
+//   on that edge from the start
+//============================================================================
+void Fleet::
+step(const TrackNetwork& network, const std::vector<TrainPhysics>& physics,
+	 float dt, WorkPool& pool)
+//============================================================================
+{
+	pool.parallelFor(size(), grain, [&](size_t b, size_t e) {
+		for (size_t i = b; i < e; ) {
+			size_t j = i + 1;
+			while (j < e && edge[j] == edge[i])
+				++j;
+			physics[edge[i]].step(dt, j - i, &s[i], &v[i], &hint[i], &cap[i]);
+			i = j;
+		}
+		for (size_t i = b; i < e; ++i) {
+			TrackNetwork::Place p(edge[i], 0);
+			if (!network.move(p, s[i]))
+				v[i] = 0;
+			if (p.edge != edge[i])
+				hint[i] = 0;
+			edge[i] = p.edge;
+			s[i] = p.s;
+		}
+	});
+}
+
+//****************************************************************************
+//
+// * the default track with a hill in it, so the trains speed up and slow
+//   down. each fleet runs for about the same number of train-steps, on
+//   one thread and then on the whole pool
+//============================================================================
+void
+benchmarkFleet(size_t maxTrains, int threads)
+//============================================================================
+{
+	CTrack track;
+	track.points[1].pos.y += 30;
+	TrackCurve curve;
+	curve.build(track.points, TrackCurve::Cardinal);
+	TrainPhysics physics;
+	physics.lifts.push_back(TrainPhysics::Lift(0, 1));	// up the hill
+	physics.prepare(curve);
+
+	WorkPool one(1);
+	WorkPool all(threads);
+	const float dt = .01f;
+
+	printf("%10s %18s %18s   (%d threads)\n", "trains", "steps/s, 1 thread",
+		   "steps/s, pool", all.size());
+	for (size_t n = 1; n <= maxTrains; n *= 10) {
+		size_t steps = 4000000 / n;
+		if (steps < 20) steps = 20;
+
+		double rate[2];
+		for (int p = 0; p < 2; ++p) {
+			WorkPool& pool = p ? all : one;
+			Fleet fleet;
+			fleet.place(n, physics.length, 20);
+
+			double start = SimClock::now();
+			for (size_t i = 0; i < steps; ++i)
+				fleet.step(physics, dt, pool);
+			double time = SimClock::now() - start;
+			rate[p] = (time > 0) ? (double)n * steps / time : 0;
+		}
+		printf("%10lu %18.3g %18.3g\n", (unsigned long)n, rate[0], rate[1]);
+	}
+	printf("pieces stolen: %lu\n", (unsigned long)all.steals);
+}
@@ -0,0 +1,112 @@
+/************************************************************************
+     File:        Frustum.cpp
+
+     Comment:     The view volume of the current camera, as six planes
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+
+#include <windows.h>
+#include <GL/gl.h>
+
+#include "Frustum.H"
+
+//****************************************************************************
+//
+// * Constructor - until extract() is called, everything is visible
+//============================================================================
+Frustum::
+Frustum()
+//============================================================================
+{
+	for (int i = 0; i < 6; ++i) {
+		planes[i][0] = planes[i][1] = planes[i][2] = 0;
+		planes[i][3] = 1;
+	}
+	wRow[0] = wRow[1] = wRow[2] = 0;
+	wRow[3] = 1;
+	yScale = 1;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Frustum::
+extract()
+//============================================================================
+{
+	float p[16], m[16], c[16];
+	glGetFloatv(GL_PROJECTION_MATRIX, p);
+	glGetFloatv(GL_MODELVIEW_MATRIX, m);
+
+	// c = p * m (column major)
+	for (int col = 0; col < 4; ++col)
+		for (int row = 0; row < 4; ++row) {
+			float s = 0;
+			for (int k = 0; k < 4; ++k)
+				s += p[k * 4 + row] * m[col * 4 + k];
+			c[col * 4 + row] = s;
+		}
+	extract(c);
+}
+
+//****************************************************************************
+//
+// * each plane is the last row of the clip matrix plus or minus one of the
+//   other rows
+//============================================================================
+void Frustum::
+extract(const float c[16])
+//============================================================================
+{
+	for (int i = 0; i < 3; ++i) {
+		for (int k = 0; k < 4; ++k) {
+			planes[2 * i    ][k] = c[k * 4 + 3] + c[k * 4 + i];
+			planes[2 * i + 1][k] = c[k * 4 + 3] - c[k * 4 + i];
+		}
+	}
+
+	for (int k = 0; k < 4; ++k)
+		wRow[k] = c[k * 4 + 3];
+	// the camera doesn't scale, so the length of the y row is the
+	// projection's own scale
+	yScale = sqrtf(c[1] * c[1] + c[5] * c[5] + c[9] * c[9]);
+}
+
+//****************************************************************************
+//
+// * the box is out if it is completely on the outside of any one plane -
+//   which we find out by testing the corner that is furthest inside
+//============================================================================
+bool Frustum::
+boxVisible(const Pnt3f& lo, const Pnt3f& hi) const
+//============================================================================
+{
+	for (int i = 0; i < 6; ++i) {
+		const float* pl = planes[i];
+		float x = (pl[0] >= 0) ? hi.x : lo.x;
+		float y = (pl[1] >= 0) ? hi.y : lo.y;
+		float z = (pl[2] >= 0) ? hi.z : lo.z;
+		if (pl[0] * x + pl[1] * y + pl[2] * z + pl[3] < 0)
+			return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// * the radius, in clip space, over w - then scaled to pixels
+//============================================================================
+float Frustum::
+pixelSize(const Pnt3f& center, float radius, int viewportHeight) const
+//============================================================================
+{
+	float w = wRow[0] * center.x + wRow[1] * center.y + wRow[2] * center.z + wRow[3];
+	if (w <= radius * .01f)
+		return 1e30f;
+	return radius * yScale * ((float)viewportHeight) / w;
+}
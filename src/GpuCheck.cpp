@@ -0,0 +1,105 @@
+/************************************************************************
+     File:        GpuCheck.cpp
+
+     Comment:     Checking the GPU rails against the CPU ones, for scripts
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <vector>
+
+#include <Fl/fl.h>
+#include <windows.h>
+#include <glad/glad.h>
+
+#pragma warning(push)
+#pragma warning(disable:4312)
+#pragma warning(disable:4311)
+#include <Fl/Fl_Gl_Window.h>
+#pragma warning(pop)
+
+#include "GpuCheck.H"
+#include "GpuSpline.H"
+#include "Track.H"
+#include "TrackCurve.H"
+
+// does the checking the first time it is drawn - that is when it has a
+// context
+class GpuCheckWindow : public Fl_Gl_Window {
+	public:
+		GpuCheckWindow(const std::vector<ControlPoint>& _points)
+			: Fl_Gl_Window(0, 0, 16, 16, "GPU check"), points(_points), done(false)
+		{
+			mode(FL_RGB | FL_DOUBLE);
+			clear_border();
+			for (int i = 0; i < 3; ++i)
+				center[i] = rails[i] = -1;
+		}
+
+		virtual void draw()
+		{
+			if (done)
+				return;
+			done = true;
+
+			if (!gladLoadGL())
+				return;
+			printf("%s\n", (const char*)glGetString(GL_RENDERER));
+
+			GpuSpline spline;
+			spline.init();
+			spline.update(points, 1);
+			for (int type = TrackCurve::Linear; type <= TrackCurve::BSpline; ++type)
+				center[type - 1] = spline.validate(points, type, 16, &rails[type - 1]);
+		}
+
+	public:
+		std::vector<ControlPoint>	points;
+		float						center[3];	// largest errors, per type
+		float						rails[3];	// (negative - not checked)
+		bool						done;
+};
+
+//****************************************************************************
+//
+// * the window is shown and waited on until it has drawn once
+//============================================================================
+bool
+reportGpuCheck(const char* filename, float tolerance)
+//============================================================================
+{
+	CTrack track;
+	if (filename) {
+		if (!track.readPoints(filename, false))
+			return false;
+	}
+	else {
+		track.points[1].pos.y += 30;
+		track.points[2].orient = Pnt3f(1, 1, 0);
+	}
+
+	GpuCheckWindow window(track.points);
+	window.show();
+	while (!window.done && window.shown())
+		Fl::wait();
+	window.hide();
+
+	static const char* names[3] = { "linear", "cardinal", "b-spline" };
+	bool ok = true;
+	printf("%lu points, tolerance %g\n", (unsigned long)track.points.size(), tolerance);
+	printf("%10s %14s %14s\n", "", "center line", "rails");
+	for (int i = 0; i < 3; ++i) {
+		if (window.center[i] < 0) {
+			printf("%10s   can't check (needs OpenGL 4.0)\n", names[i]);
+			ok = false;
+			continue;
+		}
+		bool good = window.center[i] <= tolerance && window.rails[i] <= tolerance;
+		printf("%10s %14g %14g%s\n", names[i], window.center[i], window.rails[i],
+			   good ? "" : "   too far off");
+		ok = ok && good;
+	}
+	return ok;
+}
@@ -0,0 +1,421 @@
+/************************************************************************
+     File:        GpuSpline.cpp
+
+     Comment:     The track rails, evaluated on the GPU
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <string>
+
+#include <windows.h>
+#include <glad/glad.h>
+
+#include "GpuSpline.H"
+#include "TrackCurve.H"
+
+static inline float dot(const Pnt3f& a, const Pnt3f& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float distance(const Pnt3f& a, const Pnt3f& b)
+{
+	Pnt3f d = a - b;
+	return sqrtf(dot(d, d));
+}
+
+//****************************************************************************
+//
+// * the shaders. the blending functions are the ones in TrackCurve.cpp -
+//   keep the two the same (validate() is there to check)
+//============================================================================
+static const char* splineVS =
+	"#version 400 compatibility\n"
+	"layout(location = 0) in vec3 position;\n"
+	"layout(location = 1) in vec3 orient;\n"
+	"out vec3 vOrient;\n"
+	"void main() {\n"
+	"	vOrient = orient;\n"
+	"	gl_Position = vec4(position, 1.0);\n"
+	"}\n";
+
+// weights (and their derivatives) for points i-1, i, i+1, i+2
+static const char* basisSource =
+	"uniform int splineType;\n"
+	"void basis(float t, out vec4 w, out vec4 dw) {\n"
+	"	float t2 = t * t;\n"
+	"	float t3 = t2 * t;\n"
+	"	if (splineType == 2) {\n"
+	"		const float s = 0.5;\n"
+	"		w = vec4(-s * t3 + 2.0 * s * t2 - s * t,\n"
+	"		         (2.0 - s) * t3 + (s - 3.0) * t2 + 1.0,\n"
+	"		         (s - 2.0) * t3 + (3.0 - 2.0 * s) * t2 + s * t,\n"
+	"		         s * t3 - s * t2);\n"
+	"		dw = vec4(-3.0 * s * t2 + 4.0 * s * t - s,\n"
+	"		          3.0 * (2.0 - s) * t2 + 2.0 * (s - 3.0) * t,\n"
+	"		          3.0 * (s - 2.0) * t2 + 2.0 * (3.0 - 2.0 * s) * t + s,\n"
+	"		          3.0 * s * t2 - 2.0 * s * t);\n"
+	"	} else if (splineType == 3) {\n"
+	"		float it = 1.0 - t;\n"
+	"		w = vec4(it * it * it, 3.0 * t3 - 6.0 * t2 + 4.0,\n"
+	"		         -3.0 * t3 + 3.0 * t2 + 3.0 * t + 1.0, t3) / 6.0;\n"
+	"		dw = vec4(-it * it / 2.0, (9.0 * t2 - 12.0 * t) / 6.0,\n"
+	"		          (-9.0 * t2 + 6.0 * t + 3.0) / 6.0, t2 / 2.0);\n"
+	"	} else {\n"
+	"		w = vec4(0.0, 1.0 - t, t, 0.0);\n"
+	"		dw = vec4(0.0, -1.0, 1.0, 0.0);\n"
+	"	}\n"
+	"}\n";
+
+// the number of steps comes from the length on the screen of a rough
+// (4 step) version of the segment. if any of it is behind the eye we
+// can't tell, so it gets the most. the outer level 0 is the number of
+// isolines - one for each rail
+static const char* splineTCS =
+	"#version 400 compatibility\n"
+	"layout(vertices = 4) out;\n"
+	"in vec3 vOrient[];\n"
+	"out vec3 tcOrient[];\n"
+	"uniform vec2 viewport;\n"
+	"uniform float pixelsPerStep;\n"
+	"uniform float maxLevel;\n"
+	"uniform float fixedLevel;\n";
+
+static const char* splineTCSMain =
+	"void main() {\n"
+	"	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;\n"
+	"	tcOrient[gl_InvocationID] = vOrient[gl_InvocationID];\n"
+	"	if (gl_InvocationID != 0)\n"
+	"		return;\n"
+	"	float level = fixedLevel;\n"
+	"	if (level <= 0.0) {\n"
+	"		float len = 0.0;\n"
+	"		bool behind = false;\n"
+	"		vec2 last = vec2(0.0);\n"
+	"		for (int k = 0; k <= 4; ++k) {\n"
+	"			vec4 w, dw;\n"
+	"			basis(float(k) / 4.0, w, dw);\n"
+	"			vec4 p = vec4(0.0, 0.0, 0.0, 1.0);\n"
+	"			for (int i = 0; i < 4; ++i)\n"
+	"				p.xyz += w[i] * gl_in[i].gl_Position.xyz;\n"
+	"			vec4 c = gl_ModelViewProjectionMatrix * p;\n"
+	"			behind = behind || c.w <= 0.0;\n"
+	"			vec2 s = c.xy / max(c.w, 1e-6) * viewport * 0.5;\n"
+	"			if (k > 0) len += distance(s, last);\n"
+	"			last = s;\n"
+	"		}\n"
+	"		level = behind ? maxLevel : ceil(len / pixelsPerStep);\n"
+	"	}\n"
+	"	gl_TessLevelOuter[0] = 2.0;\n"
+	"	gl_TessLevelOuter[1] = clamp(level, 1.0, maxLevel);\n"
+	"}\n";
+
+// tfU and tfPos are the parameter and the point on the center line, tfRail
+// and tfSide the point on the rail (before it is projected) and which rail
+// it is - only the feedback program keeps them
+static const char* splineTES =
+	"#version 400 compatibility\n"
+	"layout(isolines, equal_spacing) in;\n"
+	"in vec3 tcOrient[];\n"
+	"uniform float halfGauge;\n"
+	"uniform float railHeight;\n"
+	"out float tfU;\n"
+	"out vec3 tfPos;\n"
+	"out vec3 tfRail;\n"
+	"out float tfSide;\n";
+
+static const char* splineTESMain =
+	"void main() {\n"
+	"	vec4 w, dw;\n"
+	"	basis(gl_TessCoord.x, w, dw);\n"
+	"	vec3 p = vec3(0.0), d = vec3(0.0), o = vec3(0.0);\n"
+	"	for (int i = 0; i < 4; ++i) {\n"
+	"		p += w[i] * gl_in[i].gl_Position.xyz;\n"
+	"		d += dw[i] * gl_in[i].gl_Position.xyz;\n"
+	"		o += w[i] * tcOrient[i];\n"
+	"	}\n"
+	"	vec3 t = (length(d) > 1e-6) ? normalize(d) : vec3(1.0, 0.0, 0.0);\n"
+	"	vec3 up = normalize(o - t * dot(o, t));\n"
+	"	float side = (gl_TessCoord.y < 0.25) ? -1.0 : 1.0;\n"
+	"	vec3 q = p + cross(t, up) * (side * halfGauge) + up * railHeight;\n"
+	"	tfU = float(gl_PrimitiveID) + gl_TessCoord.x;\n"
+	"	tfPos = p;\n"
+	"	tfRail = q;\n"
+	"	tfSide = side;\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * vec4(q, 1.0);\n"
+	"}\n";
+
+static const char* splineFS =
+	"#version 400 compatibility\n"
+	"uniform vec3 color;\n"
+	"void main() {\n"
+	"	gl_FragColor = vec4(color, 1.0);\n"
+	"}\n";
+
+// what the feedback program writes out, per vertex
+static const char* feedbackNames[4] = { "tfU", "tfPos", "tfRail", "tfSide" };
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+GpuSpline::
+GpuSpline()
+	: gauge(4), railHeight(.5f), pixelsPerStep(4), maxLevel(64), bytesSent(0),
+	  vao(0), vertexBuffer(0), indexBuffer(0), version(0), haveVersion(false)
+//============================================================================
+{
+	feedbackShader.captureVaryings(feedbackNames, 4);
+}
+
+//****************************************************************************
+//
+// * the context is new - whatever we had went with the old one
+//============================================================================
+void GpuSpline::
+init()
+//============================================================================
+{
+	shader.invalidate();
+	feedbackShader.invalidate();
+	vao = vertexBuffer = indexBuffer = 0;
+	sent.clear();
+	haveVersion = false;
+
+	// no tessellation before GL 4.0
+	if (!GLAD_GL_VERSION_4_0)
+		return;
+
+	std::string tcs = std::string(splineTCS) + basisSource + splineTCSMain;
+	std::string tes = std::string(splineTES) + basisSource + splineTESMain;
+	shader.build(splineVS, splineFS, tcs.c_str(), tes.c_str());
+	feedbackShader.build(splineVS, 0, tcs.c_str(), tes.c_str());
+	if (!shader.valid())
+		return;
+
+	GLint most = 64;
+	glGetIntegerv(GL_MAX_TESS_GEN_LEVEL, &most);
+	if (maxLevel > most) maxLevel = most;
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vertexBuffer);
+	glGenBuffers(1, &indexBuffer);
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+						  (void*)(3 * sizeof(float)));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//****************************************************************************
+//
+// * send points [first, first+count) from the copy in sent
+//============================================================================
+void GpuSpline::
+upload(size_t first, size_t count)
+//============================================================================
+{
+	glBufferSubData(GL_ARRAY_BUFFER, first * 6 * sizeof(float),
+					count * 6 * sizeof(float), &sent[first * 6]);
+	bytesSent += (unsigned long)(count * 6 * sizeof(float));
+}
+
+//****************************************************************************
+//
+// * if the number of points is the same, only the runs of points that
+//   moved are sent. otherwise everything is, and the patches are made
+//   again (they wrap around the end of the loop)
+//============================================================================
+void GpuSpline::
+update(const std::vector<ControlPoint>& points, unsigned long _version)
+//============================================================================
+{
+	if (!valid() || (haveVersion && _version == version))
+		return;
+	version = _version;
+	haveVersion = true;
+
+	size_t n = points.size();
+	std::vector<float> now(n * 6);
+	for (size_t i = 0; i < n; ++i) {
+		float* v = &now[i * 6];
+		v[0] = points[i].pos.x;		v[1] = points[i].pos.y;		v[2] = points[i].pos.z;
+		v[3] = points[i].orient.x;	v[4] = points[i].orient.y;	v[5] = points[i].orient.z;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	bytesSent = 0;
+
+	if (now.size() != sent.size()) {
+		sent.swap(now);
+		glBufferData(GL_ARRAY_BUFFER, sent.size() * sizeof(float),
+					 sent.empty() ? 0 : &sent[0], GL_DYNAMIC_DRAW);
+		bytesSent += (unsigned long)(sent.size() * sizeof(float));
+
+		std::vector<GLuint> idx(n * 4);
+		for (size_t i = 0; i < n; ++i) {
+			idx[i * 4 + 0] = (GLuint)((i + n - 1) % n);
+			idx[i * 4 + 1] = (GLuint)i;
+			idx[i * 4 + 2] = (GLuint)((i + 1) % n);
+			idx[i * 4 + 3] = (GLuint)((i + 2) % n);
+		}
+		glBindVertexArray(vao);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(GLuint),
+					 idx.empty() ? 0 : &idx[0], GL_STATIC_DRAW);
+		glBindVertexArray(0);
+		bytesSent += (unsigned long)(idx.size() * sizeof(GLuint));
+	}
+	else {
+		size_t first = 0, count = 0;
+		for (size_t i = 0; i < n; ++i) {
+			bool moved = false;
+			for (int k = 0; k < 6; ++k)
+				if (now[i * 6 + k] != sent[i * 6 + k]) {
+					sent[i * 6 + k] = now[i * 6 + k];
+					moved = true;
+				}
+			if (moved) {
+				if (!count) first = i;
+				++count;
+			}
+			else if (count) {
+				upload(first, count);
+				count = 0;
+			}
+		}
+		if (count)
+			upload(first, count);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//****************************************************************************
+//
+// * both rails in one draw call. whatever program was bound (the shadowed
+//   lighting, say) is put back afterwards
+//============================================================================
+int GpuSpline::
+draw(int type, int viewportWidth, int viewportHeight, bool doingShadows)
+//============================================================================
+{
+	if (!valid() || sent.empty())
+		return 0;
+	int n = (int)(sent.size() / 6);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+
+	shader.use();
+	glUniform1i(shader.uniform("splineType"), type);
+	glUniform2f(shader.uniform("viewport"), (float)viewportWidth, (float)viewportHeight);
+	glUniform1f(shader.uniform("pixelsPerStep"), pixelsPerStep);
+	glUniform1f(shader.uniform("maxLevel"), (float)maxLevel);
+	glUniform1f(shader.uniform("fixedLevel"), 0);
+	glUniform1f(shader.uniform("halfGauge"), gauge / 2);
+	glUniform1f(shader.uniform("railHeight"), railHeight);
+	if (!doingShadows)
+		glUniform3f(shader.uniform("color"), 32 / 255.f, 32 / 255.f, 64 / 255.f);
+
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	glBindVertexArray(vao);
+	glLineWidth(2);
+	glDrawElements(GL_PATCHES, n * 4, GL_UNSIGNED_INT, 0);
+	glLineWidth(1);
+	glBindVertexArray(0);
+
+	glUseProgram(previous);
+	return n;
+}
+
+//****************************************************************************
+//
+// * every patch gives 2 isolines of level steps, so 2 * level lines, each
+//   with both of its ends written out. the rasterizer is switched off -
+//   nothing gets drawn. the rails are put where TrackMesh puts them: out
+//   sideways (tangent x up) by half the gauge, and up by railHeight
+//============================================================================
+float GpuSpline::
+validate(const std::vector<ControlPoint>& points, int type, int level, float* railError)
+//============================================================================
+{
+	size_t n = points.size();
+	if (!feedbackShader.valid() || n == 0 || sent.size() != n * 6)
+		return -1;
+	if (level > maxLevel) level = maxLevel;
+
+	size_t expected = n * 2 * level;				// lines
+	size_t floats = expected * 2 * 8;				// 2 ends, u + xyz + rail xyz + side
+
+	GLuint buffer = 0, query = 0;
+	glGenBuffers(1, &buffer);
+	glGenQueries(1, &query);
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+	glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, floats * sizeof(float), 0, GL_STATIC_READ);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+
+	feedbackShader.use();
+	glUniform1i(feedbackShader.uniform("splineType"), type);
+	glUniform1f(feedbackShader.uniform("maxLevel"), (float)maxLevel);
+	glUniform1f(feedbackShader.uniform("fixedLevel"), (float)level);
+	glUniform1f(feedbackShader.uniform("halfGauge"), gauge / 2);
+	glUniform1f(feedbackShader.uniform("railHeight"), railHeight);
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	glBindVertexArray(vao);
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+	glBeginTransformFeedback(GL_LINES);
+	glDrawElements(GL_PATCHES, (GLsizei)(n * 4), GL_UNSIGNED_INT, 0);
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glUseProgram(previous);
+
+	GLuint written = 0;
+	glGetQueryObjectuiv(query, GL_QUERY_RESULT, &written);
+
+	std::vector<float> out(floats);
+	if (written == expected)
+		glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, floats * sizeof(float), &out[0]);
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+	glDeleteQueries(1, &query);
+	glDeleteBuffers(1, &buffer);
+
+	if (written != expected)
+		return -1;
+
+	float worst = 0, worstRail = 0;
+	for (size_t i = 0; i < floats; i += 8) {
+		Pnt3f p, d, o;
+		TrackCurve::evaluate(points, type, out[i], p, d, o);
+		float e = distance(p, Pnt3f(out[i + 1], out[i + 2], out[i + 3]));
+		if (e > worst) worst = e;
+
+		float dl = sqrtf(dot(d, d));
+		d = (dl > 1e-6f) ? d * (1 / dl) : Pnt3f(1, 0, 0);
+		Pnt3f up = o - d * dot(o, d);
+		up.normalize();
+		Pnt3f rail = p + (d * up) * (out[i + 7] * gauge / 2) + up * railHeight;
+		e = distance(rail, Pnt3f(out[i + 4], out[i + 5], out[i + 6]));
+		if (e > worstRail) worstRail = e;
+	}
+	if (railError)
+		*railError = worstRail;
+	return worst;
+}
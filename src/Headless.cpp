@@ -0,0 +1,188 @@
+/************************************************************************
+     File:        Headless.cpp
+
+     Comment:     Running the train with no window
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "Headless.H"
+#include "Simulation.H"
+
+static inline float dot(const Pnt3f& a, const Pnt3f& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// the most the riders felt one way, and where along the track
+struct Peak {
+	Peak(float start) : g(start), s(0) {}
+	void more(float x, float at) { if (x > g) { g = x; s = at; } }
+	void less(float x, float at) { if (x < g) { g = x; s = at; } }
+	float	g;
+	float	s;
+};
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Headless::
+Headless()
+	: mode(Slider), speed(2), splineType(TrackCurve::Cardinal),
+	  maxTicks(1000000), laps(1), sidecar(false)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool Headless::
+run(const char* filename)
+//============================================================================
+{
+	CTrack track;
+	if (!track.readPoints(filename, false))
+		return false;
+
+	typedef Simulation::Command Command;
+	Simulation sim;
+	sim.writeSidecars = sidecar;
+	Command set(Command::SetPoints);
+	set.points = track.points;
+	set.name = track.cacheFile;
+	sim.apply(set);
+	sim.apply(Command(Command::SetSplineType, splineType));
+	sim.apply(Command(Command::SetSpeed, 0, speed));
+	sim.apply(Command(Command::SetPhysics, 0, mode == Coast ? 1.0f : 0.0f));
+	sim.apply(Command(Command::SetPlanned, 0, mode == Planned ? 1.0f : 0.0f));
+	sim.apply(Command(Command::SetRunning, 0, 1));
+
+	double t0 = SimClock::now();
+	sim.resample();
+	double sampleTime = SimClock::now() - t0;
+
+	Simulation::State state;
+	sim.getState(state);
+	float dt = (float)state.step;
+	const TrackCurve& curve = *sim.trackCurve();
+	float length = curve.length;
+
+	static const char* types[] = { "", "linear", "cardinal", "b-spline" };
+	static const char* modes[] = { "at the slider's speed", "with physics", "at the planned speed" };
+	printf("%s: %lu points, %s, %.1f around, %s\n", filename,
+		   (unsigned long)track.points.size(), types[splineType % 4], length, modes[mode]);
+	printf("sampling%s the track took %.2f ms\n",
+		   mode == Planned ? " (and planning)" : "", sampleTime * 1000);
+	if (curve.size() < 4 || length <= 0) {
+		printf("there is no track to ride\n");
+		return false;
+	}
+
+	// the curvature at each sample - how fast the tangent turns - as in
+	// the SpeedPlanner. the last sample is the first one again
+	size_t n = curve.size() - 1;
+	std::vector<Pnt3f> bend(n + 1);
+	for (size_t i = 0; i < n; ++i) {
+		size_t ip = i + 1, im = (i + n - 1) % n;
+		float ds = curve.arc[ip] - curve.arc[i];
+		ds += i ? curve.arc[i] - curve.arc[im] : length - curve.arc[im];
+		bend[i] = (curve.tangent[ip] - curve.tangent[im]) * (ds > 0 ? 1 / ds : 0);
+	}
+	bend[n] = bend[0];
+
+	float g = TrainPhysics::Params().gravity;
+	Peak up(-1e30f), down(1e30f), side(0), along(0);
+
+	std::vector<double> stepTimes;
+	stepTimes.reserve((size_t)std::min(maxTicks, 10000000UL));
+	std::vector<float> lapTimes;
+	unsigned long lapStart = 0;
+
+	float s = curve.arcAt(sim.trainParameter());
+	float v = 0;
+	double distance = 0;
+	int k = 0;
+	unsigned long tick;
+	for (tick = 1; tick <= maxTicks; ++tick) {
+		double a = SimClock::now();
+		sim.tick();
+		stepTimes.push_back(SimClock::now() - a);
+
+		// how far it went, across the start if it did
+		float s1 = curve.arcAt(sim.trainParameter());
+		float ds = s1 - s;
+		if (ds < -length / 2)
+			ds += length;
+		else if (ds > length / 2)
+			ds -= length;
+		float v1 = ds / dt;
+
+		// what the riders feel, from the second step on (the first one has
+		// no speed to compare with)
+		if (tick > 1) {
+			Pnt3f pos, tangent, upDir;
+			curve.frames(&s1, 1, &pos, &tangent, &upDir);
+			while (k < (int)n - 1 && curve.arc[k + 1] <= s1)
+				++k;
+			while (k > 0 && curve.arc[k] > s1)
+				--k;
+
+			Pnt3f felt = tangent * ((v1 - v) / dt) + bend[k] * (v1 * v1) + Pnt3f(0, g, 0);
+			float u = dot(felt, upDir) / g;
+			up.more(u, s1);
+			down.less(u, s1);
+			side.more(fabsf(dot(felt, tangent * upDir)) / g, s1);
+			along.more(fabsf(dot(felt, tangent)) / g, s1);
+		}
+		s = s1;
+		v = v1;
+
+		distance += ds;
+		if (distance >= (double)length * (lapTimes.size() + 1)) {
+			lapTimes.push_back((tick - lapStart) * dt);
+			printf("lap %lu: %.2f s\n", (unsigned long)lapTimes.size(), lapTimes.back());
+			lapStart = tick;
+			if (laps && lapTimes.size() >= laps)
+				break;
+		}
+	}
+	if (tick > maxTicks)
+		tick = maxTicks;
+
+	if (lapTimes.empty())
+		printf("no laps in %lu steps (%.0f%% of the way round)\n",
+			   tick, 100 * distance / length);
+	else
+		printf("%lu laps in %lu steps: best %.2f s, worst %.2f s\n",
+			   (unsigned long)lapTimes.size(), tick,
+			   *std::min_element(lapTimes.begin(), lapTimes.end()),
+			   *std::max_element(lapTimes.begin(), lapTimes.end()));
+	if (tick > 1)
+		printf("riders felt from %.2f g up (at %.1f) to %.2f g (at %.1f), %.2f g sideways "
+			   "(at %.1f), %.2f g along (at %.1f)\n",
+			   down.g, down.s, up.g, up.s, side.g, side.s, along.g, along.s);
+
+	if (stepTimes.empty())
+		return false;
+	double total = 0;
+	for (size_t i = 0; i < stepTimes.size(); ++i)
+		total += stepTimes[i];
+	std::sort(stepTimes.begin(), stepTimes.end());
+	size_t count = stepTimes.size();
+	printf("%lu steps took %.2f ms: %.2f us each, %.2f us median, %.2f us at 99%%, "
+		   "%.2f us worst - %.0f times real time\n",
+		   (unsigned long)count, total * 1000, total * 1e6 / count,
+		   stepTimes[count / 2] * 1e6, stepTimes[count * 99 / 100] * 1e6,
+		   stepTimes[count - 1] * 1e6, total > 0 ? count * dt / total : 0.0);
+
+	return lapTimes.size() >= laps;
+}
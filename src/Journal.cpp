@@ -0,0 +1,433 @@
+/************************************************************************
+     File:        Journal.cpp
+
+     Comment:     Every edit, kept on the disk as it is made
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "Journal.H"
+#include "Recorder.H"
+#include "SafeFile.H"
+#include "TrackFile.H"
+#include "Varint.H"
+
+static const char		magic[4] = { 'T', 'R', 'K', 'J' };
+static const unsigned	formatVersion = 2;	// 1 had no names
+static const size_t		headerBytes = 8;
+
+//****************************************************************************
+//
+// * a command as it goes in a record - a SetPoints has its name after it
+//============================================================================
+static void putEdit(std::vector<unsigned char>& body, const Simulation::Command& c,
+					float& lastValue, Pnt3f& lastWhere)
+{
+	putCommand(body, c, lastValue, lastWhere);
+	if (c.kind == Simulation::Command::SetPoints) {
+		putVarint(body, c.name.size());
+		body.insert(body.end(), c.name.begin(), c.name.end());
+	}
+}
+
+//****************************************************************************
+//
+// * a record: the length, the command, the CRC-32 of the command
+//============================================================================
+static void frame(std::vector<unsigned char>& out, const std::vector<unsigned char>& body)
+{
+	putVarint(out, body.size());
+	out.insert(out.end(), body.begin(), body.end());
+	uint32_t crc = body.empty() ? 0 : crcOf(&body[0], body.size());
+	for (int k = 0; k < 4; ++k)
+		out.push_back((unsigned char)(crc >> (8 * k)));
+}
+
+static void header(std::vector<unsigned char>& out)
+{
+	out.insert(out.end(), magic, magic + sizeof(magic));
+	for (int k = 0; k < 4; ++k)
+		out.push_back((unsigned char)(formatVersion >> (8 * k)));
+}
+
+// a whole new file, all or nothing
+static bool startFile(const char* filename, const std::vector<unsigned char>& bytes)
+{
+	SafeFile file;
+	if (!file.open(filename))
+		return false;
+	bool ok = fwrite(&bytes[0], 1, bytes.size(), file.file()) == bytes.size();
+	return ok && file.commit();
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Journal::
+Journal()
+	: syncInterval(.5), lastValue(0), lastWhere(0, 0, 0), restart(false), quit(false)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * the session is over - the edits don't need to be kept
+//============================================================================
+Journal::
+~Journal()
+//============================================================================
+{
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeup.notify_one();
+	thread.join();
+	remove(filename.c_str());
+}
+
+//****************************************************************************
+//
+// * the first checkpoint is written right here, so a journal that can't
+//   be written is found out at once
+//============================================================================
+bool Journal::
+open(const char* name, const std::vector<ControlPoint>& points, const std::string& pointsName)
+//============================================================================
+{
+	if (thread.joinable())
+		return false;
+	filename = name;
+
+	checkpoint(points, pointsName);
+	std::vector<unsigned char> first;
+	first.swap(pending);
+	restart = false;
+	if (!startFile(filename.c_str(), first))
+		return false;
+
+	thread = std::thread(&Journal::write, this);
+	return true;
+}
+
+//****************************************************************************
+//
+// * the edits up to now don't matter any more - a new file starts from
+//   these points
+//============================================================================
+void Journal::
+checkpoint(const std::vector<ControlPoint>& points, const std::string& name)
+//============================================================================
+{
+	lastValue = 0;
+	lastWhere = Pnt3f(0, 0, 0);
+
+	Simulation::Command c(Simulation::Command::SetPoints);
+	c.points = points;
+	c.name = name;
+	body.clear();
+	putEdit(body, c, lastValue, lastWhere);
+
+	std::vector<unsigned char> fresh;
+	header(fresh);
+	frame(fresh, body);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.swap(fresh);
+		restart = true;
+	}
+	wakeup.notify_one();
+}
+
+//****************************************************************************
+//
+// * on the simulation thread - this should cost it next to nothing, so the
+//   thread isn't woken; it gets to the edit within syncInterval
+//============================================================================
+void Journal::
+edit(const Simulation::Command& c)
+//============================================================================
+{
+	body.clear();
+	record.clear();
+	putEdit(body, c, lastValue, lastWhere);
+	frame(record, body);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.insert(pending.end(), record.begin(), record.end());
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool Journal::
+isEdit(const Simulation::Command& c)
+//============================================================================
+{
+	switch (c.kind) {
+		case Simulation::Command::MovePoint:
+		case Simulation::Command::AddPoint:
+		case Simulation::Command::DeletePoint:
+		case Simulation::Command::RollX:
+		case Simulation::Command::RollZ:
+		case Simulation::Command::SetPoints:
+			return true;
+		default:
+			return false;
+	}
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool Journal::
+append(FILE* fp, const std::vector<unsigned char>& bytes)
+//============================================================================
+{
+	if (fwrite(&bytes[0], 1, bytes.size(), fp) != bytes.size() || fflush(fp))
+		return false;
+#ifdef _WIN32
+	return !_commit(_fileno(fp));
+#else
+	return !fsync(fileno(fp));
+#endif
+}
+
+//****************************************************************************
+//
+// * the journal's thread: every syncInterval (or at once, for a new file)
+//   take what has piled up and get it onto the disk
+//============================================================================
+void Journal::
+write()
+//============================================================================
+{
+	FILE* fp = fopen(filename.c_str(), "ab");
+	std::vector<unsigned char> bytes;
+	for (;;) {
+		bool fresh, done;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeup.wait_for(lock, std::chrono::duration<double>(syncInterval),
+							[this] { return quit || restart; });
+			bytes.swap(pending);
+			fresh = restart;
+			restart = false;
+			done = quit;
+		}
+
+		if (fresh) {
+			if (fp)
+				fclose(fp);
+			fp = startFile(filename.c_str(), bytes) ? fopen(filename.c_str(), "ab") : 0;
+		}
+		else if (fp && !bytes.empty() && !append(fp, bytes)) {
+			// the disk is full, or gone - stop, rather than leave a
+			// journal with a hole in it
+			fclose(fp);
+			fp = 0;
+		}
+		bytes.clear();
+		if (done)
+			break;
+	}
+	if (fp)
+		fclose(fp);
+}
+
+//****************************************************************************
+//
+// * reading the varint lengths straight out of the file
+//============================================================================
+struct JournalSource {
+	JournalSource(const std::vector<unsigned char>& d, size_t a) : data(d), at(a), bad(false) {}
+	unsigned char byte()
+	{
+		if (at >= data.size()) {
+			bad = true;
+			return 0;
+		}
+		return data[at++];
+	}
+
+	const std::vector<unsigned char>&	data;
+	size_t								at;
+	bool								bad;
+};
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+recoverJournal(const char* filename, std::vector<Simulation::Command>& commands)
+//============================================================================
+{
+	commands.clear();
+	FILE* fp = fopen(filename, "rb");
+	if (!fp)
+		return false;
+	std::vector<unsigned char> data;
+	unsigned char block[65536];
+	size_t n;
+	while ((n = fread(block, 1, sizeof(block), fp)) > 0)
+		data.insert(data.end(), block, block + n);
+	fclose(fp);
+
+	if (data.size() < headerBytes || memcmp(&data[0], magic, sizeof(magic)))
+		return false;
+	unsigned version = data[4] | data[5] << 8 | data[6] << 16 | (unsigned)data[7] << 24;
+	if (version < 1 || version > formatVersion)
+		return false;
+
+	// the records, up to the first one that isn't all there (where it
+	// crashed)
+	float lastValue = 0;
+	Pnt3f lastWhere(0, 0, 0);
+	JournalSource in(data, headerBytes);
+	std::vector<unsigned char> body;
+	for (;;) {
+		unsigned long long length = readVarint(in);
+		if (in.bad || length > data.size() - in.at || data.size() - in.at - length < 4)
+			break;
+		body.assign(data.begin() + in.at, data.begin() + in.at + (size_t)length);
+		const unsigned char* c = &data[in.at + (size_t)length];
+		uint32_t crc = c[0] | c[1] << 8 | c[2] << 16 | (uint32_t)c[3] << 24;
+		if (crc != (body.empty() ? 0 : crcOf(&body[0], body.size())))
+			break;
+
+		Simulation::Command command(Simulation::Command::SetPoints);
+		size_t at = 0;
+		if (!readCommand(body, at, command, lastValue, lastWhere) || !Journal::isEdit(command))
+			break;
+		if (version >= 2 && command.kind == Simulation::Command::SetPoints) {
+			JournalSource name(body, at);
+			unsigned long long n = readVarint(name);
+			if (name.bad || n > body.size() - name.at)
+				break;
+			command.name.assign(body.begin() + name.at, body.begin() + name.at + (size_t)n);
+			at = name.at + (size_t)n;
+		}
+		if (at != body.size())
+			break;
+		commands.push_back(command);
+		in.at += (size_t)length + 4;
+	}
+
+	if (commands.empty() || commands[0].kind != Simulation::Command::SetPoints) {
+		commands.clear();
+		return false;
+	}
+	return commands.size() > 1;
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+JournalLock::
+JournalLock()
+#ifdef _WIN32
+	: handle(INVALID_HANDLE_VALUE)
+#else
+	: fd(-1)
+#endif
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * the lock file goes first, while it is still held - so nobody takes a
+//   lock on a file that is about to vanish
+//============================================================================
+JournalLock::
+~JournalLock()
+//============================================================================
+{
+#ifdef _WIN32
+	if (handle != INVALID_HANDLE_VALUE)
+		CloseHandle((HANDLE)handle);		// it is deleted on close
+#else
+	if (fd >= 0) {
+		remove(lockName.c_str());
+		close(fd);
+	}
+#endif
+}
+
+//****************************************************************************
+//
+// * a lock the system lets go of when the program ends, however it ends
+//============================================================================
+bool JournalLock::
+lock(const std::string& name)
+//============================================================================
+{
+#ifdef _WIN32
+	// nobody else can open it while it is open here
+	HANDLE h = CreateFileA(name.c_str(), GENERIC_WRITE, 0, 0, OPEN_ALWAYS,
+						   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+	handle = h;
+#else
+	int f = open(name.c_str(), O_RDWR | O_CREAT, 0644);
+	if (f < 0)
+		return false;
+	if (flock(f, LOCK_EX | LOCK_NB)) {
+		close(f);
+		return false;
+	}
+	fd = f;
+#endif
+	lockName = name;
+	return true;
+}
+
+//****************************************************************************
+//
+// * the journals left by crashes first, so they are found again
+//============================================================================
+bool JournalLock::
+claim(const char* base)
+//============================================================================
+{
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int k = 1; k <= maxJournals; ++k) {
+			char number[16];
+			snprintf(number, sizeof(number), ".%d", k);
+			std::string name = std::string(base) + number + ".journal";
+			FILE* fp = fopen(name.c_str(), "rb");
+			if (fp)
+				fclose(fp);
+			if ((fp != 0) != (pass == 0))
+				continue;
+			if (lock(std::string(base) + number + ".lock")) {
+				filename = name;
+				return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,126 @@
+/************************************************************************
+     File:        MappedFile.cpp
+
+     Comment:     A whole file mapped into memory, read only
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include "MappedFile.H"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+MappedFile::
+MappedFile()
+	: bytes(0), length(0),
+#ifdef _WIN32
+	  file(INVALID_HANDLE_VALUE), mapping(0)
+#else
+	  fd(-1)
+#endif
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+MappedFile::
+~MappedFile()
+//============================================================================
+{
+	close();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool MappedFile::
+open(const char* filename)
+//============================================================================
+{
+	close();
+
+#ifdef _WIN32
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+					   FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		close();
+		return false;
+	}
+	length = (size_t)size.QuadPart;
+	if (!length)
+		return true;
+
+	mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (mapping)
+		bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close();
+		return false;
+	}
+	length = (size_t)st.st_size;
+	if (!length)
+		return true;
+
+	void* p = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED)
+		bytes = (const unsigned char*)p;
+#endif
+
+	if (!bytes) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void MappedFile::
+close()
+//============================================================================
+{
+#ifdef _WIN32
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = 0;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (bytes)
+		munmap((void*)bytes, length);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	bytes = 0;
+	length = 0;
+}
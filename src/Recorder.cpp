@@ -0,0 +1,484 @@
+/************************************************************************
+     File:        Recorder.cpp
+
+     Comment:     Recording the simulation, and playing it back exactly
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <string.h>
+#include <algorithm>
+
+#include "Recorder.H"
+#include "Varint.H"
+
+// the start of every recording, and the kinds of record
+static const char			magic[8] = { 'T', 'R', 'A', 'I', 'N', 'R', 'E', 'C' };
+static const unsigned		formatVersion = 2;
+enum { CommandRecord = 'C', StepsRecord = 'S', KeyframeRecord = 'K' };
+
+//****************************************************************************
+//
+// * writing
+//============================================================================
+static unsigned bits(float f)
+{
+	unsigned u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+static void putFloat(std::vector<unsigned char>& out, float f, float last)
+{
+	putVarint(out, bits(f) ^ bits(last));
+}
+static void putPoints(std::vector<unsigned char>& out, const std::vector<ControlPoint>& points)
+{
+	putVarint(out, points.size());
+	ControlPoint last(Pnt3f(0, 0, 0), Pnt3f(0, 0, 0));
+	for (size_t i = 0; i < points.size(); ++i) {
+		const ControlPoint& p = points[i];
+		putFloat(out, p.pos.x, last.pos.x);
+		putFloat(out, p.pos.y, last.pos.y);
+		putFloat(out, p.pos.z, last.pos.z);
+		putFloat(out, p.orient.x, last.orient.x);
+		putFloat(out, p.orient.y, last.orient.y);
+		putFloat(out, p.orient.z, last.orient.z);
+		last = p;
+	}
+}
+
+//****************************************************************************
+//
+// * reading - anything off the end makes it bad, and reads as zeros
+//============================================================================
+struct Reader {
+	Reader(const std::vector<unsigned char>& d, size_t at)
+		: p(d.empty() ? 0 : &d[0] + at), end(d.empty() ? 0 : &d[0] + d.size()),
+		  start(d.empty() ? 0 : &d[0]), bad(false) {}
+
+	size_t offset() const { return p - start; }
+	bool done() const { return p >= end; }
+
+	unsigned char byte()
+	{
+		if (p >= end) {
+			bad = true;
+			return 0;
+		}
+		return *p++;
+	}
+	unsigned long long varint() { return readVarint(*this); }
+	long long signedVarint() { return unzigzag(varint()); }
+	float real(float last)
+	{
+		unsigned u = (unsigned)varint() ^ bits(last);
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+	void points(std::vector<ControlPoint>& pts)
+	{
+		size_t n = (size_t)varint();
+		if (n > (size_t)(end - p)) {		// at least a byte a point
+			bad = true;
+			return;
+		}
+		pts.resize(n);
+		ControlPoint last(Pnt3f(0, 0, 0), Pnt3f(0, 0, 0));
+		for (size_t i = 0; i < n; ++i) {
+			ControlPoint& c = pts[i];
+			c.pos.x = real(last.pos.x);
+			c.pos.y = real(last.pos.y);
+			c.pos.z = real(last.pos.z);
+			c.orient.x = real(last.orient.x);
+			c.orient.y = real(last.orient.y);
+			c.orient.z = real(last.orient.z);
+			last = c;
+		}
+	}
+
+	const unsigned char*	p;
+	const unsigned char*	end;
+	const unsigned char*	start;
+	bool					bad;
+};
+
+//****************************************************************************
+//
+// * the record bodies, both ways
+//============================================================================
+static void putState(std::vector<unsigned char>& out, const Simulation::State& s)
+{
+	putVarint(out, s.ticks);
+	unsigned long long step;
+	memcpy(&step, &s.step, sizeof(step));
+	putVarint(out, step);
+	putFloat(out, s.trainU, 0);
+	putFloat(out, s.lastTrainU, 0);
+	putFloat(out, s.speed, 0);
+	putFloat(out, s.trainSpeed, 0);
+	putVarint(out, s.splineType);
+	putVarint(out, (s.running ? 1 : 0) | (s.physics ? 2 : 0) | (s.planned ? 4 : 0));
+	putPoints(out, s.points);
+	putVarint(out, s.trainEdge);
+	putVarint(out, s.branches.size());
+	for (size_t i = 0; i < s.branches.size(); ++i)
+		putPoints(out, s.branches[i]);
+	putVarint(out, s.switches.size());
+	for (size_t i = 0; i < s.switches.size(); ++i)
+		putVarint(out, s.switches[i]);
+}
+static void getState(Reader& in, Simulation::State& s)
+{
+	s.ticks = (unsigned long)in.varint();
+	unsigned long long step = in.varint();
+	memcpy(&s.step, &step, sizeof(step));
+	s.trainU = in.real(0);
+	s.lastTrainU = in.real(0);
+	s.speed = in.real(0);
+	s.trainSpeed = in.real(0);
+	s.splineType = (int)in.varint();
+	unsigned flags = (unsigned)in.varint();
+	s.running = (flags & 1) != 0;
+	s.physics = (flags & 2) != 0;
+	s.planned = (flags & 4) != 0;
+	in.points(s.points);
+	s.trainEdge = (int)in.varint();
+	size_t n = (size_t)in.varint();
+	if (n > (size_t)(in.end - in.p)) {		// at least a byte a branch
+		in.bad = true;
+		return;
+	}
+	s.branches.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		in.points(s.branches[i]);
+	n = (size_t)in.varint();
+	if (n > (size_t)(in.end - in.p)) {
+		in.bad = true;
+		return;
+	}
+	s.switches.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		s.switches[i] = (int)in.varint();
+}
+void putCommand(std::vector<unsigned char>& out, const Simulation::Command& c,
+				float& lastValue, Pnt3f& lastWhere)
+{
+	putVarint(out, c.kind);
+	putSigned(out, c.index);
+	putFloat(out, c.value, lastValue);
+	lastValue = c.value;
+	if (c.kind == Simulation::Command::MovePoint) {
+		putFloat(out, c.where.x, lastWhere.x);
+		putFloat(out, c.where.y, lastWhere.y);
+		putFloat(out, c.where.z, lastWhere.z);
+		lastWhere = c.where;
+	}
+	if (c.kind == Simulation::Command::SetPoints || c.kind == Simulation::Command::AddBranch)
+		putPoints(out, c.points);
+}
+static void getCommand(Reader& in, Simulation::Command& c, float& lastValue, Pnt3f& lastWhere)
+{
+	c.kind = (Simulation::Command::Kind)in.varint();
+	c.index = (int)in.signedVarint();
+	c.value = lastValue = in.real(lastValue);
+	if (c.kind == Simulation::Command::MovePoint) {
+		c.where.x = in.real(lastWhere.x);
+		c.where.y = in.real(lastWhere.y);
+		c.where.z = in.real(lastWhere.z);
+		lastWhere = c.where;
+	}
+	if (c.kind == Simulation::Command::SetPoints || c.kind == Simulation::Command::AddBranch)
+		in.points(c.points);
+}
+
+bool readCommand(const std::vector<unsigned char>& data, size_t& at, Simulation::Command& c,
+				 float& lastValue, Pnt3f& lastWhere)
+{
+	Reader in(data, at);
+	getCommand(in, c, lastValue, lastWhere);
+	at = in.offset();
+	return !in.bad;
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Recorder::
+Recorder()
+	: file(0), lastValue(0), lastWhere(0, 0, 0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+Recorder::
+~Recorder()
+//============================================================================
+{
+	close();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool Recorder::
+open(const char* filename, const Simulation::State& s)
+//============================================================================
+{
+	close();
+	file = fopen(filename, "wb");
+	if (!file) {
+		printf("Can't write the recording %s\n", filename);
+		return false;
+	}
+
+	buffer.assign(magic, magic + sizeof(magic));
+	putVarint(buffer, formatVersion);
+	keyframe(s);
+	flush();
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Recorder::
+close()
+//============================================================================
+{
+	if (file) {
+		flush();
+		fclose(file);
+		file = 0;
+	}
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Recorder::
+command(const Simulation::Command& c)
+//============================================================================
+{
+	buffer.push_back(CommandRecord);
+	putCommand(buffer, c, lastValue, lastWhere);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Recorder::
+steps(int n)
+//============================================================================
+{
+	buffer.push_back(StepsRecord);
+	putVarint(buffer, n);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Recorder::
+keyframe(const Simulation::State& s)
+//============================================================================
+{
+	buffer.push_back(KeyframeRecord);
+	putState(buffer, s);
+	lastValue = 0;
+	lastWhere = Pnt3f(0, 0, 0);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Recorder::
+flush()
+//============================================================================
+{
+	if (file && !buffer.empty()) {
+		fwrite(&buffer[0], 1, buffer.size(), file);
+		fflush(file);
+	}
+	buffer.clear();
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Replay::
+Replay()
+	: lastTick(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * read it all in, then go through it once to find the keyframes. a
+//   recording that was cut off (the program died) is good up to the last
+//   whole record
+//============================================================================
+bool Replay::
+open(const char* filename)
+//============================================================================
+{
+	data.clear();
+	keyframes.clear();
+	lastTick = 0;
+
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) {
+		printf("Can't open the recording %s\n", filename);
+		return false;
+	}
+	unsigned char chunk[65536];
+	size_t got;
+	while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		data.insert(data.end(), chunk, chunk + got);
+	fclose(fp);
+
+	if (data.size() < sizeof(magic) || memcmp(&data[0], magic, sizeof(magic))) {
+		printf("%s isn't a recording\n", filename);
+		return false;
+	}
+	Reader in(data, sizeof(magic));
+	if (in.varint() != formatVersion) {
+		printf("%s is from a different version\n", filename);
+		return false;
+	}
+
+	unsigned long tick = 0;
+	float lastValue = 0;
+	Pnt3f lastWhere(0, 0, 0);
+	size_t good = in.offset();
+	while (!in.done()) {
+		size_t at = in.offset();
+		unsigned char kind = in.byte();
+		if (kind == CommandRecord) {
+			Simulation::Command c(Simulation::Command::MoveTrain);
+			getCommand(in, c, lastValue, lastWhere);
+		}
+		else if (kind == StepsRecord)
+			tick += (unsigned long)in.varint();
+		else if (kind == KeyframeRecord) {
+			Simulation::State s;
+			getState(in, s);
+			Keyframe k = { s.ticks, at };
+			if (!in.bad) {
+				keyframes.push_back(k);
+				tick = s.ticks;
+			}
+			lastValue = 0;
+			lastWhere = Pnt3f(0, 0, 0);
+		}
+		else
+			in.bad = true;
+
+		if (in.bad)
+			break;
+		good = in.offset();
+		lastTick = tick;
+	}
+	data.resize(good);
+
+	if (keyframes.empty()) {
+		printf("%s has nothing in it\n", filename);
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// * from the last keyframe at or before tick
+//============================================================================
+bool Replay::
+seek(unsigned long tick, Simulation& sim) const
+//============================================================================
+{
+	if (keyframes.empty() || tick < keyframes[0].tick || tick > lastTick)
+		return false;
+
+	size_t k = keyframes.size() - 1;
+	while (keyframes[k].tick > tick)
+		--k;
+
+	Reader in(data, keyframes[k].offset);
+	in.byte();
+	Simulation::State s;
+	getState(in, s);
+	sim.setState(s);
+	sim.resample();
+
+	unsigned long at = s.ticks;
+	float lastValue = 0;
+	Pnt3f lastWhere(0, 0, 0);
+	while (at < tick && !in.done() && !in.bad) {
+		unsigned char kind = in.byte();
+		if (kind == CommandRecord) {
+			Simulation::Command c(Simulation::Command::MoveTrain);
+			getCommand(in, c, lastValue, lastWhere);
+			sim.apply(c);
+		}
+		else if (kind == StepsRecord) {
+			unsigned long n = (unsigned long)in.varint();
+			if (n > tick - at)
+				n = tick - at;
+			sim.resample();
+			for (unsigned long i = 0; i < n; ++i)
+				sim.tick();
+			at += n;
+		}
+		else if (kind == KeyframeRecord) {
+			getState(in, s);
+			lastValue = 0;
+			lastWhere = Pnt3f(0, 0, 0);
+		}
+	}
+	return at == tick;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void
+reportReplay(const char* filename, unsigned long tick)
+//============================================================================
+{
+	Replay replay;
+	if (!replay.open(filename))
+		return;
+	if (!tick)
+		tick = replay.ticks();
+
+	Simulation sim;
+	double start = SimClock::now();
+	if (!replay.seek(tick, sim)) {
+		printf("There is no step %lu in %s (it has up to %lu)\n",
+			   tick, filename, replay.ticks());
+		return;
+	}
+	double time = SimClock::now() - start;
+
+	Simulation::State s;
+	sim.getState(s);
+	printf("step %lu of %lu: train at %.6f (bits %08x) on edge %d, going %.4f, %lu points\n",
+		   tick, replay.ticks(), s.trainU, bits(s.trainU), s.trainEdge, s.trainSpeed,
+		   (unsigned long)s.points.size());
+	printf("got there in %.1f ms - %.0f steps a second\n", time * 1000,
+		   time > 0 ? tick / time : 0.0);
+}
@@ -0,0 +1,118 @@
+/************************************************************************
+     File:        SafeFile.cpp
+
+     Comment:     Writing a file so that it is never half written
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include "SafeFile.H"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+SafeFile::
+SafeFile()
+	: fp(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+SafeFile::
+~SafeFile()
+//============================================================================
+{
+	abandon();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool SafeFile::
+open(const char* filename)
+//============================================================================
+{
+	abandon();
+	name = filename;
+	temp = name + ".tmp";
+	fp = fopen(temp.c_str(), "wb");
+	return fp != 0;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void SafeFile::
+abandon()
+//============================================================================
+{
+	if (fp) {
+		fclose(fp);
+		fp = 0;
+		remove(temp.c_str());
+	}
+}
+
+//****************************************************************************
+//
+// * flush stdio, then the operating system's cache, then swap it in
+//============================================================================
+bool SafeFile::
+commit()
+//============================================================================
+{
+	if (!fp)
+		return false;
+
+	bool ok = !fflush(fp) && !ferror(fp);
+#ifdef _WIN32
+	ok = ok && !_commit(_fileno(fp));
+#else
+	ok = ok && !fsync(fileno(fp));
+#endif
+	ok = !fclose(fp) && ok;
+	fp = 0;
+	if (!ok) {
+		remove(temp.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	if (!MoveFileExA(temp.c_str(), name.c_str(),
+					 MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		remove(temp.c_str());
+		return false;
+	}
+#else
+	if (rename(temp.c_str(), name.c_str())) {
+		remove(temp.c_str());
+		return false;
+	}
+
+	// and the directory, so the new name is on the disk too
+	size_t slash = name.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." : name.substr(0, slash + 1);
+	int fd = ::open(dir.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		::close(fd);
+	}
+#endif
+	return true;
+}
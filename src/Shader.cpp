@@ -0,0 +1,163 @@
+/************************************************************************
+     File:        Shader.cpp
+
+     Comment:     Tiny wrapper around a GLSL program object
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <vector>
+
+#include <windows.h>
+#include <glad/glad.h>
+
+#include "Shader.H"
+
+//****************************************************************************
+//
+// * compile a single stage, print the log if it fails
+//============================================================================
+static GLuint compileStage(GLenum type, const char* src)
+//============================================================================
+{
+	GLuint s = glCreateShader(type);
+	glShaderSource(s, 1, &src, 0);
+	glCompileShader(s);
+
+	GLint ok = 0;
+	glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		GLint len = 0;
+		glGetShaderiv(s, GL_INFO_LOG_LENGTH, &len);
+		std::vector<char> log(len > 1 ? len : 1, 0);
+		glGetShaderInfoLog(s, (GLsizei)log.size(), 0, &log[0]);
+		fprintf(stderr, "Shader compile error:\n%s\n", &log[0]);
+		glDeleteShader(s);
+		return 0;
+	}
+	return s;
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Shader::
+Shader() : program(0), feedbackNames(0), feedbackCount(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * compile all of the given stages and link them into one program
+//============================================================================
+bool Shader::
+build(const char* vertexSrc, const char* fragmentSrc,
+	  const char* tessControlSrc, const char* tessEvalSrc, const char* geometrySrc)
+//============================================================================
+{
+	release();
+
+	const GLenum types[5] = { GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER,
+							  GL_TESS_EVALUATION_SHADER, GL_GEOMETRY_SHADER,
+							  GL_FRAGMENT_SHADER };
+	const char* srcs[5] = { vertexSrc, tessControlSrc, tessEvalSrc,
+							geometrySrc, fragmentSrc };
+
+	GLuint p = glCreateProgram();
+	GLuint stages[5] = { 0, 0, 0, 0, 0 };
+	bool ok = true;
+	for (int i = 0; i < 5 && ok; ++i) {
+		if (!srcs[i]) continue;
+		stages[i] = compileStage(types[i], srcs[i]);
+		if (stages[i]) glAttachShader(p, stages[i]);
+		else ok = false;
+	}
+
+	if (ok) {
+		if (feedbackCount)
+			glTransformFeedbackVaryings(p, feedbackCount, feedbackNames, GL_INTERLEAVED_ATTRIBS);
+		glLinkProgram(p);
+		GLint linked = 0;
+		glGetProgramiv(p, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			GLint len = 0;
+			glGetProgramiv(p, GL_INFO_LOG_LENGTH, &len);
+			std::vector<char> log(len > 1 ? len : 1, 0);
+			glGetProgramInfoLog(p, (GLsizei)log.size(), 0, &log[0]);
+			fprintf(stderr, "Shader link error:\n%s\n", &log[0]);
+			ok = false;
+		}
+	}
+
+	// the program keeps what it needs once it is linked
+	for (int i = 0; i < 5; ++i)
+		if (stages[i]) glDeleteShader(stages[i]);
+
+	if (!ok) {
+		glDeleteProgram(p);
+		return false;
+	}
+	program = p;
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Shader::
+captureVaryings(const char* const* names, int count)
+//============================================================================
+{
+	feedbackNames = names;
+	feedbackCount = count;
+}
+
+//****************************************************************************
+//
+// * the context went away, and the program with it
+//============================================================================
+void Shader::
+invalidate()
+//============================================================================
+{
+	program = 0;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Shader::
+release()
+//============================================================================
+{
+	if (program) glDeleteProgram(program);
+	program = 0;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Shader::
+use() const
+//============================================================================
+{
+	glUseProgram(program);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+int Shader::
+uniform(const char* name) const
+//============================================================================
+{
+	return glGetUniformLocation(program, name);
+}
@@ -0,0 +1,293 @@
+/************************************************************************
+     File:        ShadowMap.cpp
+
+     Comment:     Shadow mapping for the (directional) main light
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <string>
+
+#include <windows.h>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ShadowMap.H"
+
+// the map lives on this texture unit, so it stays out of the way of
+// anything textured on unit 0
+static const int shadowUnit = 1;
+
+//****************************************************************************
+//
+// * shared receiver code - percentage closer filtering over a square kernel
+//   (each tap is itself a 2x2 hardware compare, since the map is GL_LINEAR)
+//============================================================================
+const char* ShadowMap::pcfSource =
+	"#version 120\n"
+	"uniform sampler2DShadow shadowMap;\n"
+	"uniform mat4 eyeToLight;\n"
+	"uniform float shadowTexel;\n"
+	"uniform float shadowBias;\n"
+	"uniform int pcfRadius;\n"
+	"uniform float shadowOn;\n"
+	"float shadowFactor(vec4 eyePos) {\n"
+	"	if (shadowOn < 0.5) return 1.0;\n"
+	"	vec4 sc = eyeToLight * eyePos;\n"
+	"	vec3 p = sc.xyz / sc.w;\n"
+	"	if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)\n"
+	"		return 1.0;\n"
+	"	p.z = min(p.z, 1.0);	// behind every caster (the floor, mostly)\n"
+	"	float sum = 0.0;\n"
+	"	float n = 0.0;\n"
+	"	for (int y = -4; y <= 4; ++y) {\n"
+	"		for (int x = -4; x <= 4; ++x) {\n"
+	"			if (abs(x) > pcfRadius || abs(y) > pcfRadius) continue;\n"
+	"			vec2 o = vec2(float(x), float(y)) * shadowTexel;\n"
+	"			sum += shadow2D(shadowMap, vec3(p.xy + o, p.z - shadowBias)).r;\n"
+	"			n += 1.0;\n"
+	"		}\n"
+	"	}\n"
+	"	return sum / n;\n"
+	"}\n";
+
+//****************************************************************************
+//
+// * the object shader - per pixel version of the fixed function lighting
+//   that TrainView sets up (directional lights, GL_COLOR_MATERIAL with
+//   ambient and diffuse), with the first light shadowed
+//============================================================================
+static const char* objectVS =
+	"#version 120\n"
+	"varying vec3 normal;\n"
+	"varying vec4 eyePos;\n"
+	"void main() {\n"
+	"	eyePos = gl_ModelViewMatrix * gl_Vertex;\n"
+	"	normal = gl_NormalMatrix * gl_Normal;\n"
+	"	gl_FrontColor = gl_Color;\n"
+	"	gl_Position = ftransform();\n"
+	"}\n";
+
+static const char* objectFS =
+	"uniform vec3 lightOn;\n"
+	"varying vec3 normal;\n"
+	"varying vec4 eyePos;\n"
+	"void main() {\n"
+	"	vec3 n = normalize(normal);\n"
+	"	vec4 c = gl_Color;\n"
+	"	vec3 lit = gl_LightModel.ambient.rgb * c.rgb;\n"
+	"	for (int i = 0; i < 3; ++i) {\n"
+	"		if (lightOn[i] < 0.5) continue;\n"
+	"		vec4 lp = gl_LightSource[i].position;\n"
+	"		vec3 l = normalize(lp.w == 0.0 ? lp.xyz : lp.xyz - eyePos.xyz);\n"
+	"		float d = max(dot(n, l), 0.0);\n"
+	"		if (i == 0) d *= shadowFactor(eyePos);\n"
+	"		lit += c.rgb * (gl_LightSource[i].ambient.rgb + d * gl_LightSource[i].diffuse.rgb);\n"
+	"	}\n"
+	"	gl_FragColor = vec4(lit, c.a);\n"
+	"}\n";
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool ShadowMap::Key::
+operator == (const Key& k) const
+//============================================================================
+{
+	return trackVersion == k.trackVersion && networkVersion == k.networkVersion &&
+		trainEdge == k.trainEdge && trainS == k.trainS && cars == k.cars &&
+		splineType == k.splineType && gpuTrack == k.gpuTrack && camera == k.camera &&
+		resolution == k.resolution && light[0] == k.light[0] &&
+		light[1] == k.light[1] && light[2] == k.light[2];
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+ShadowMap::
+ShadowMap()
+	: resolution(2048), pcfRadius(1), bias(.0015f),
+	  fbo(0), depthTex(0), allocated(0), haveMap(false)
+//============================================================================
+{
+	memset(lightMatrix, 0, sizeof(lightMatrix));
+	memset(&key, 0, sizeof(key));
+}
+
+//****************************************************************************
+//
+// * a new context - whatever we had belonged to the old one
+//============================================================================
+void ShadowMap::
+init()
+//============================================================================
+{
+	fbo = 0;
+	depthTex = 0;
+	allocated = 0;
+	haveMap = false;
+
+	objectShader.invalidate();
+	objectShader.build(objectVS, (std::string(pcfSource) + objectFS).c_str());
+}
+
+//****************************************************************************
+//
+// * (re)create the depth texture and the framebuffer that renders into it
+//============================================================================
+void ShadowMap::
+allocate()
+//============================================================================
+{
+	if (!fbo) glGenFramebuffers(1, &fbo);
+	if (depthTex) glDeleteTextures(1, &depthTex);
+	glGenTextures(1, &depthTex);
+
+	glBindTexture(GL_TEXTURE_2D, depthTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, resolution, resolution,
+				 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	float border[4] = { 1, 1, 1, 1 };	// outside the map is never in shadow
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	allocated = resolution;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool ShadowMap::
+stale(const Key& k) const
+//============================================================================
+{
+	return !haveMap || allocated != resolution || !(k == key);
+}
+
+//****************************************************************************
+//
+// * set up an orthographic "camera" looking down the light direction that
+//   just fits the box around the casters
+//============================================================================
+void ShadowMap::
+begin(const Key& k, const float lightDir[3], const Pnt3f& lo, const Pnt3f& hi)
+//============================================================================
+{
+	if (allocated != resolution) allocate();
+
+	glm::vec3 center((lo.x + hi.x) * .5f, (lo.y + hi.y) * .5f, (lo.z + hi.z) * .5f);
+	float radius = glm::length(glm::vec3(hi.x - lo.x, hi.y - lo.y, hi.z - lo.z)) * .5f + 1.0f;
+	glm::vec3 dir = glm::normalize(glm::vec3(lightDir[0], lightDir[1], lightDir[2]));
+	glm::vec3 up = (fabs(dir.y) > .99f) ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+
+	glm::mat4 view = glm::lookAt(center + dir * (2 * radius), center, up);
+	glm::mat4 proj = glm::ortho(-radius, radius, -radius, radius, radius, 3 * radius);
+
+	// clip space [-1,1] to texture space [0,1]
+	glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(.5f)) *
+					 glm::scale(glm::mat4(1.0f), glm::vec3(.5f));
+	glm::mat4 m = bias * proj * view;
+	memcpy(lightMatrix, glm::value_ptr(m), sizeof(lightMatrix));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, resolution, resolution);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(glm::value_ptr(proj));
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(glm::value_ptr(view));
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_POLYGON_BIT);
+	glUseProgram(0);
+	glDisable(GL_LIGHTING);
+	glEnable(GL_DEPTH_TEST);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	key = k;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void ShadowMap::
+end()
+//============================================================================
+{
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	haveMap = true;
+}
+
+//****************************************************************************
+//
+// * the receivers work in eye space, so fold the inverse of the camera into
+//   the light matrix once here rather than per vertex
+//============================================================================
+void ShadowMap::
+bind(const Shader& shader, bool on)
+//============================================================================
+{
+	if (!shader.valid()) return;
+
+	float view[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, view);
+	glm::mat4 eyeToLight = glm::make_mat4(lightMatrix) * glm::inverse(glm::make_mat4(view));
+
+	glActiveTexture(GL_TEXTURE0 + shadowUnit);
+	glBindTexture(GL_TEXTURE_2D, depthTex);
+	glActiveTexture(GL_TEXTURE0);
+
+	int r = pcfRadius < 0 ? 0 : (pcfRadius > maxPcfRadius ? maxPcfRadius : pcfRadius);
+
+	shader.use();
+	glUniform1i(shader.uniform("shadowMap"), shadowUnit);
+	glUniformMatrix4fv(shader.uniform("eyeToLight"), 1, GL_FALSE, glm::value_ptr(eyeToLight));
+	glUniform1f(shader.uniform("shadowTexel"), 1.0f / ((float)allocated));
+	glUniform1f(shader.uniform("shadowBias"), bias);
+	glUniform1i(shader.uniform("pcfRadius"), r);
+	glUniform1f(shader.uniform("shadowOn"), (on && haveMap) ? 1.0f : 0.0f);
+
+	if (&shader == &objectShader)
+		glUniform3f(shader.uniform("lightOn"),
+					glIsEnabled(GL_LIGHT0) ? 1.0f : 0.0f,
+					glIsEnabled(GL_LIGHT1) ? 1.0f : 0.0f,
+					glIsEnabled(GL_LIGHT2) ? 1.0f : 0.0f);
+	glUseProgram(0);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void ShadowMap::
+unbind()
+//============================================================================
+{
+	glUseProgram(0);
+	glActiveTexture(GL_TEXTURE0 + shadowUnit);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
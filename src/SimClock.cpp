@@ -0,0 +1,79 @@
+/************************************************************************
+     File:        SimClock.cpp
+
+     Comment:     A fixed time step for the simulation
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <chrono>
+
+#include "SimClock.H"
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+SimClock::
+SimClock(double _step, int _maxSteps)
+	: step(_step), maxSteps(_maxSteps), simTime(0)
+//============================================================================
+{
+	start();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+double SimClock::
+now()
+//============================================================================
+{
+	typedef std::chrono::steady_clock Clock;
+	return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void SimClock::
+start()
+//============================================================================
+{
+	simTime = now();
+}
+
+//****************************************************************************
+//
+// * whole steps between the last one and now. if there are too many, the
+//   oldest ones are skipped
+//============================================================================
+int SimClock::
+steps()
+//============================================================================
+{
+	int n = (int)((now() - simTime) / step);
+	if (n > maxSteps) {
+		simTime += (n - maxSteps) * step;
+		n = maxSteps;
+	}
+	simTime += n * step;
+	return n;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+float SimClock::
+alpha() const
+//============================================================================
+{
+	double a = (now() - simTime) / step;
+	if (a < 0) return 0;
+	if (a > 1) return 1;
+	return (float)a;
+}
@@ -0,0 +1,692 @@
+/************************************************************************
+     File:        Simulation.cpp
+
+     Comment:     The world, run on a thread of its own
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+#include "Simulation.H"
+#include "Journal.H"
+#include "Recorder.H"
+#include "TrackCache.H"
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+WorldSnapshot::
+WorldSnapshot()
+	: serial(0), trackVersion(0), splineType(TrackCurve::Cardinal), networkVersion(0),
+	  trainEdge(0), trainU(0), trainMoved(0), trainSpeed(0), stepTime(0), step(.01), running(false),
+	  inputTime(0), ticks(0), recording(false), unsaved(false), planned(false), lapTime(0),
+	  planTime(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * back from where the train is by the part of the last step that hasn't
+//   happened yet. if the train jumped (the points changed, say) it didn't
+//   move, so it goes right where it is
+//============================================================================
+TrackNetwork::Place WorldSnapshot::
+trainPlace(double now) const
+//============================================================================
+{
+	TrackNetwork::Place p(trainEdge, 0);
+	if (!network || trainEdge < 0 || trainEdge >= (int)network->edges.size() ||
+		!network->edges[trainEdge].curve)
+		return p;
+	p.s = network->edges[trainEdge].curve->arcAt(trainU);
+	if (!running || trainMoved == 0)
+		return p;
+
+	double a = (now - stepTime) / step;
+	if (a < 0) a = 0;
+	if (a > 1) a = 1;
+	network->move(p, -trainMoved * (float)(1 - a));
+	return p;
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Simulation::Command::
+Command(Kind k, int i, float v)
+	: kind(k), index(i), value(v), time(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * Constructor - the first snapshot goes out right away, so there is
+//   something to draw before the thread has even started
+//============================================================================
+Simulation::
+Simulation()
+	: frameInterval(1.0 / 60), keyframeInterval(1000), writeSidecars(false),
+	  running(false), speed(2),
+	  splineType(TrackCurve::Cardinal), physics(false), networkVersion(0),
+	  trainOn(0), trainMoved(0), planned(false), plannedSpeed(0),
+	  ticks(0), lastKeyframe(0),
+	  curveVersion(0), curveType(0), publishedVersion(0), cacheVersion(0), savedVersion(0),
+	  serial(0), inputTime(0), lastNotify(0), quit(false),
+	  notify(0), notifyData(0)
+//============================================================================
+{
+	fleet.place(1, 0, 0);
+	savedVersion = track.version;
+	publish(0);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+Simulation::
+~Simulation()
+//============================================================================
+{
+	stop();
+	if (sidecarWriter.joinable())
+		sidecarWriter.join();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Simulation::
+start(void (*_notify)(void*), void* data)
+//============================================================================
+{
+	if (thread.joinable())
+		return;
+	notify = _notify;
+	notifyData = data;
+	quit = false;
+	thread = std::thread(&Simulation::run, this);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Simulation::
+stop()
+//============================================================================
+{
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeup.notify_one();
+	thread.join();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Simulation::
+post(const Command& c)
+//============================================================================
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(c);
+		queue.back().time = SimClock::now();
+	}
+	wakeup.notify_one();
+}
+
+//****************************************************************************
+//
+// * sleep until there is a command (or, while running, the next step is
+//   due), then do everything that piled up and publish the result
+//============================================================================
+void Simulation::
+run()
+//============================================================================
+{
+	std::vector<Command> work;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (running)
+				wakeup.wait_for(lock, std::chrono::duration<double>(clock.step),
+								[this] { return quit || !queue.empty(); });
+			else
+				wakeup.wait(lock, [this] { return quit || !queue.empty(); });
+			if (quit)
+				return;
+			work.assign(queue.begin(), queue.end());
+			queue.clear();
+		}
+
+		double newest = 0;
+		for (size_t i = 0; i < work.size(); ++i) {
+			if (recorder && work[i].kind != Command::Record &&
+				work[i].kind != Command::KeepJournal)
+				recorder->command(work[i]);
+			if (journal) {
+				if (work[i].kind == Command::SetPoints && !work[i].index)
+					journal->checkpoint(work[i].points, work[i].name);
+				else if (Journal::isEdit(work[i]))
+					journal->edit(work[i]);
+			}
+			apply(work[i]);
+			if (work[i].time > newest) newest = work[i].time;
+		}
+
+		resample();
+
+		int n = running ? clock.steps() : 0;
+		for (int i = 0; i < n; ++i)
+			tick();
+
+		if (recorder) {
+			if (n)
+				recorder->steps(n);
+			if (ticks - lastKeyframe >= keyframeInterval) {
+				State s;
+				getState(s);
+				recorder->keyframe(s);
+				lastKeyframe = ticks;
+			}
+			recorder->flush();
+		}
+
+		if (!work.empty() || n)
+			publish(newest);
+	}
+}
+
+//****************************************************************************
+//
+// * one step of the clock, however the train is being moved
+//============================================================================
+void Simulation::
+tick()
+//============================================================================
+{
+	++ticks;
+	if (physics)
+		coastTrain();
+	else if (planned)
+		planTrain();
+	else
+		advanceTrain();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Simulation::
+getState(State& s) const
+//============================================================================
+{
+	s.points = track.points;
+	s.branches.clear();
+	for (size_t e = 1; e < network.edges.size(); ++e)
+		s.branches.push_back(network.edges[e].points);
+	s.switches.clear();
+	for (size_t i = 0; i < network.nodes.size(); ++i) {
+		s.switches.push_back(network.nodes[i].outSetting);
+		s.switches.push_back(network.nodes[i].inSetting);
+	}
+	s.trainEdge = trainOn;
+	s.trainU = track.trainU;
+	s.lastTrainU = track.lastTrainU;
+	s.speed = speed;
+	s.trainSpeed = fleet.v[0];
+	s.splineType = splineType;
+	s.running = running;
+	s.physics = physics;
+	s.planned = planned;
+	s.step = clock.step;
+	s.ticks = ticks;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void Simulation::
+setState(const State& s)
+//============================================================================
+{
+	track.points = s.points;
+	track.changed();
+	network = TrackNetwork();
+	network.makeLoop(track.points);
+	for (size_t b = 0; b < s.branches.size() && !network.nodes.empty(); ++b)
+		network.addEdge(0, 0, s.branches[b]);
+	for (size_t i = 0; i + 1 < s.switches.size() && i / 2 < network.nodes.size(); i += 2) {
+		network.setSwitch((int)(i / 2), s.switches[i]);
+		network.setTrailing((int)(i / 2), s.switches[i + 1]);
+	}
+	++networkVersion;
+	trainOn = (s.trainEdge >= 0 && s.trainEdge < (int)network.edges.size()) ? s.trainEdge : 0;
+	trainMoved = 0;
+	track.trainU = s.trainU;
+	track.lastTrainU = s.lastTrainU;
+	speed = s.speed;
+	fleet.v[0] = s.trainSpeed;
+	splineType = s.splineType;
+	running = s.running;
+	physics = s.physics;
+	planned = s.planned;
+	clock.step = s.step;
+	ticks = s.ticks;
+}
+
+//****************************************************************************
+//
+// * the physics for each edge goes off the ends of it, for the network to
+//   take the train on. the chain takes the train up out of the station -
+//   the first piece of every edge, as they all start at the switch there
+//============================================================================
+void Simulation::
+prepareEdges()
+//============================================================================
+{
+	edgePhysics.resize(network.edges.size());
+	for (size_t e = 0; e < edgePhysics.size(); ++e) {
+		TrainPhysics& p = edgePhysics[e];
+		const std::shared_ptr<const TrackCurve>& c = network.edges[e].curve;
+		if (!c || p.current(*c))
+			continue;
+		p.wrap = false;
+		p.lifts.clear();
+		p.lifts.push_back(TrainPhysics::Lift(0, 1));
+		p.prepare(*c);
+	}
+}
+
+//****************************************************************************
+//
+// * the train's parameter is turned into arc length and back, so the
+//   buttons (and edits) that move the train still work
+//============================================================================
+void Simulation::
+moveTrain(float ds)
+//============================================================================
+{
+	int hint = 0;
+	TrackNetwork::Place p(trainOn, edgePhysics[trainOn].arcAt(track.trainU, hint));
+	network.move(p, ds);
+	if (p.edge != trainOn)
+		hint = 0;
+
+	track.lastTrainU = track.trainU;
+	trainOn = p.edge;
+	track.trainU = edgePhysics[trainOn].paramAt(p.s, hint);
+	trainMoved = ds;
+}
+
+//****************************************************************************
+//
+// * These get called once for every step of the simulation clock
+//   (clock.step seconds) if the train is running
+//============================================================================
+void Simulation::
+advanceTrain(float dir)
+//============================================================================
+{
+	//#####################################################################
+	// TODO: make this work for your train
+	//#####################################################################
+	// a speed of 2 goes .3 control points per second - however long they
+	// are where the train is (past the end of its edge, the way the last
+	// bit of it goes)
+	prepareEdges();
+	const TrainPhysics& p = edgePhysics[trainOn];
+	float du = dir * (float)(speed * .15 * clock.step);
+	int hint = 0;
+	float s = p.arcAt(track.trainU, hint);
+	moveTrain(p.arcAt(track.trainU + du, hint) - s);
+}
+
+//****************************************************************************
+//
+// * the physics works in arc length, on the edge the train is on. the
+//   chain goes faster with the speed slider
+//============================================================================
+void Simulation::
+coastTrain()
+//============================================================================
+{
+	prepareEdges();
+	for (size_t e = 0; e < edgePhysics.size(); ++e)
+		edgePhysics[e].params.liftSpeed = speed * 5;
+
+	fleet.edge[0] = trainOn;
+	fleet.s[0] = edgePhysics[trainOn].arcAt(track.trainU, fleet.hint[0]);
+	fleet.step(network, edgePhysics, (float)clock.step, pool);
+
+	track.lastTrainU = track.trainU;
+	trainOn = fleet.edge[0];
+	track.trainU = edgePhysics[trainOn].paramAt(fleet.s[0], fleet.hint[0]);
+	trainMoved = fleet.v[0] * (float)clock.step;
+}
+
+//****************************************************************************
+//
+// * the plan goes by arc length too. the speed is the one where the train
+//   is at the start of the step - the plan is for the loop, so off it (on
+//   a branch) the train keeps the speed it had
+//============================================================================
+void Simulation::
+planTrain()
+//============================================================================
+{
+	prepareEdges();
+	if (!planner.current(*curve))
+		planner.plan(*curve, pool);
+
+	if (trainOn == 0) {
+		int hint = 0;
+		float s = edgePhysics[0].arcAt(track.trainU, hint);
+		plannedSpeed = planner.speedAt(s, hint);
+	}
+	moveTrain(plannedSpeed * (float)clock.step);
+}
+
+//****************************************************************************
+//
+// * make one change to the world
+//============================================================================
+void Simulation::
+apply(const Command& c)
+//============================================================================
+{
+	vector<ControlPoint>& pts = track.points;
+	int npts = (int)pts.size();
+	bool valid = c.index >= 0 && c.index < npts;
+
+	switch (c.kind) {
+		case Command::MovePoint:
+			if (valid) {
+				pts[c.index].pos = c.where;
+				track.changed();
+			}
+			break;
+
+		case Command::AddPoint: {
+			// pick a reasonable location
+			int newidx = valid ? c.index : 0;
+			int previdx = (newidx + npts - 1) % npts;
+			Pnt3f npos = (pts[previdx].pos + pts[newidx].pos) * .5f;
+			pts.insert(pts.begin() + newidx, npos);
+			track.changed();
+
+			// make it so that the train doesn't move - unless its affected
+			// by this control point it should stay between the same points
+			if (trainOn == 0 && ceil(track.trainU) > ((float)newidx)) {
+				track.trainU += 1;
+				if (track.trainU >= npts) track.trainU -= npts;
+			}
+			track.lastTrainU = track.trainU;
+			trainMoved = 0;
+			break;
+		}
+
+		case Command::DeletePoint:
+			if (npts > 4) {
+				if (valid)
+					pts.erase(pts.begin() + c.index);
+				else
+					pts.pop_back();
+				track.changed();
+				if (trainOn == 0 && track.trainU >= npts - 1)
+					track.trainU -= npts - 1;
+				track.lastTrainU = track.trainU;
+				trainMoved = 0;
+			}
+			break;
+
+		case Command::RollX:
+		case Command::RollZ:
+			if (valid) {
+				Pnt3f old = pts[c.index].orient;
+				const float eighth = 3.14159265f / 4;
+				float si = sinf(eighth * c.value);
+				float co = cosf(eighth * c.value);
+				if (c.kind == Command::RollX) {
+					pts[c.index].orient.y = co * old.y - si * old.z;
+					pts[c.index].orient.z = si * old.y + co * old.z;
+				} else {
+					pts[c.index].orient.y = co * old.y - si * old.x;
+					pts[c.index].orient.x = si * old.y + co * old.x;
+				}
+				track.changed();
+			}
+			break;
+
+		case Command::SetPoints: {
+			// a reload of a track that hadn't been edited is as good as saved
+			// a new track starts without the old one's branches
+			bool clean = track.version == savedVersion;
+			pts = c.points;
+			if (c.value == 0) {
+				network = TrackNetwork();
+				network.makeLoop(pts);
+				++networkVersion;
+				trainOn = 0;
+			}
+			if (c.value == 0 || (trainOn == 0 && track.trainU >= (float)pts.size()))
+				track.trainU = track.lastTrainU = 0;
+			trainMoved = 0;
+			track.changed();
+			track.cacheFile = c.name;
+			cacheVersion = track.version;
+			if (c.index == 0 || (c.value != 0 && clean))
+				savedVersion = track.version;
+			break;
+		}
+
+		case Command::MoveTrain:
+			resample();
+			advanceTrain(c.value);
+			break;
+
+		case Command::SetRunning:
+			running = c.value != 0;
+			if (running) {
+				clock.start();
+				track.lastTrainU = track.trainU;
+				trainMoved = 0;
+			}
+			break;
+
+		case Command::SetSpeed:
+			speed = c.value;
+			break;
+
+		case Command::SetSplineType:
+			splineType = c.index;
+			break;
+
+		case Command::SetPhysics:
+			// give it a push to start with
+			physics = c.value != 0;
+			fleet.v[0] = speed * 5;
+			break;
+
+		case Command::SetPlanned:
+			planned = c.value != 0;
+			break;
+
+		case Command::Record:
+			recorder.reset();
+			if (c.value != 0) {
+				State s;
+				getState(s);
+				recorder.reset(new Recorder);
+				if (!recorder->open(c.name.c_str(), s))
+					recorder.reset();
+				lastKeyframe = ticks;
+			}
+			break;
+
+		case Command::KeepJournal:
+			journal.reset();
+			if (c.value != 0) {
+				journal.reset(new Journal);
+				if (!journal->open(c.name.c_str(), pts, track.cacheFile))
+					journal.reset();
+			}
+			break;
+
+		case Command::Saved: {
+			// the journal starts again from what was saved - and if there
+			// were edits since, they are one edit now
+			bool edited = pts.size() != c.points.size() ||
+						  (!pts.empty() &&
+						   memcmp(&pts[0], &c.points[0], pts.size() * sizeof(ControlPoint)));
+			if (!edited)
+				savedVersion = track.version;
+			if (journal) {
+				journal->checkpoint(c.points, c.name);
+				if (edited) {
+					Command now(Command::SetPoints, 1);
+					now.points = pts;
+					now.name = c.name;
+					journal->edit(now);
+				}
+			}
+			break;
+		}
+
+		case Command::AddBranch:
+			if (!network.nodes.empty() && !c.points.empty()) {
+				network.addEdge(0, 0, c.points);
+				++networkVersion;
+			}
+			break;
+
+		case Command::SetSwitch:
+			// one lever: the route out is the route back in
+			if (c.index >= 0 && c.index < (int)network.nodes.size()) {
+				network.setSwitch(c.index, (int)c.value);
+				network.setTrailing(c.index, (int)c.value);
+				++networkVersion;
+			}
+			break;
+	}
+}
+
+//****************************************************************************
+//
+// * copy the points and sample the curve again - if they changed. points
+//   just as they were loaded can have their curve in a sidecar: it is read
+//   from there if it is there, and written there (if writeSidecars - the
+//   sidecar's thread has the points and the curve to itself, since neither
+//   is ever changed) if it isn't. otherwise, when only a
+//   few points moved, only the bits of the curve they reach are sampled
+//============================================================================
+void Simulation::
+resample()
+//============================================================================
+{
+	if (!points || curveVersion != track.version || curveType != splineType) {
+		std::shared_ptr<const std::vector<ControlPoint> > before = points;
+		if (!points || curveVersion != track.version)
+			points = std::make_shared<const std::vector<ControlPoint> >(track.points);
+
+		std::shared_ptr<TrackCurve> c = std::make_shared<TrackCurve>();
+		bool cache = !track.cacheFile.empty() && cacheVersion == track.version &&
+					 track.points.size() >= minCachePoints;
+		bool same = curve && before && curveType == splineType;
+		const char* sidecar = track.cacheFile.c_str();
+		if (!cache || !readCurveCache(sidecar, track.points, splineType, *c)) {
+			if (!same || !c->update(*curve, *before, track.points))
+				c->build(track.points, splineType);
+			if (cache && writeSidecars) {
+				// only waits if the last one is still being written
+				if (sidecarWriter.joinable())
+					sidecarWriter.join();
+				std::shared_ptr<const std::vector<ControlPoint> > p = points;
+				std::shared_ptr<const TrackCurve> written = c;
+				std::string filename = sidecar;
+				sidecarWriter = std::thread([p, written, filename] {
+					writeCurveCache(filename.c_str(), *p, *written);
+				});
+			}
+		}
+		curve = c;
+		curveVersion = track.version;
+		curveType = splineType;
+
+		// the loop is the network's edge 0 - the branches are only sampled
+		// again if the start of the loop moved
+		network.makeLoop(track.points, curve);
+		++networkVersion;
+	}
+	network.update(splineType, 100);
+
+	// a new curve gets a new plan right away, so the snapshot has it
+	if (planned && !planner.current(*curve))
+		planner.plan(*curve, pool);
+}
+
+//****************************************************************************
+//
+// * copy the world into the writer's slot and pass it on
+//============================================================================
+void Simulation::
+publish(double newest)
+//============================================================================
+{
+	resample();
+	if (newest > 0)
+		inputTime = newest;
+
+	WorldSnapshot& s = snapshots.back();
+	s.serial = ++serial;
+	s.trackVersion = track.version;
+	s.splineType = splineType;
+	s.points = points;
+	s.curve = curve;
+	if (!published || publishedVersion != networkVersion) {
+		published = std::make_shared<const TrackNetwork>(network);
+		publishedVersion = networkVersion;
+	}
+	s.network = published;
+	s.networkVersion = networkVersion;
+	s.trainEdge = trainOn;
+	s.trainU = track.trainU;
+	s.trainMoved = trainMoved;
+	s.trainSpeed = physics ? fleet.v[0] : (planned ? plannedSpeed : 0);
+	s.stepTime = clock.time();
+	s.step = clock.step;
+	s.running = running;
+	s.inputTime = inputTime;
+	s.ticks = ticks;
+	s.recording = recorder != 0;
+	s.unsaved = track.version != savedVersion;
+	s.planned = planned;
+	s.lapTime = planner.lapTime;
+	s.planTime = planner.planTime;
+	snapshots.publish();
+
+	// edits go out right away, the train moving along only once a frame
+	double now = SimClock::now();
+	if (notify && (newest > 0 || now - lastNotify >= frameInterval)) {
+		lastNotify = now;
+		notify(notifyData);
+	}
+}
@@ -0,0 +1,219 @@
+/************************************************************************
+     File:        SpeedPlanner.cpp
+
+     Comment:     How fast the train can go at every point of the track
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+
+#include "SpeedPlanner.H"
+#include "SimClock.H"
+
+static inline float dot(const Pnt3f& a, const Pnt3f& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+//****************************************************************************
+//
+// * Constructor - about what a big coaster does
+//============================================================================
+SpeedPlanner::Limits::
+Limits()
+	: gravity(32), upMax(4), upMin(-.5f), lateral(1.5f), accel(.3f), brake(.6f),
+	  maxSpeed(80), minSpeed(3)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+SpeedPlanner::
+SpeedPlanner()
+	: chunkSize(1024), lapTime(0), planTime(0), serial(0), length(0), start(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * the arc length from the slowest sample to entry j
+//============================================================================
+float SpeedPlanner::
+along(size_t j) const
+//============================================================================
+{
+	size_t n = arc.size() - 1;
+	if (j >= n)
+		return length;
+	float a = arc[(start + j) % n] - arc[start];
+	return (a < 0) ? a + length : a;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void SpeedPlanner::
+plan(const TrackCurve& curve, WorkPool& pool)
+//============================================================================
+{
+	double t0 = SimClock::now();
+	serial = curve.serial;
+	arc = curve.arc;
+	length = curve.length;
+
+	// the last sample is the first one again
+	size_t n = curve.size() ? curve.size() - 1 : 0;
+	if (n < 3 || length <= 0) {
+		limit.assign(curve.size(), limits.minSpeed);
+		speed = limit;
+		lapTime = 0;
+		planTime = SimClock::now() - t0;
+		return;
+	}
+
+	// what the g's allow at each sample, squared
+	const Limits& L = limits;
+	std::vector<float> cap(n);
+	pool.parallelFor(n, chunkSize, [&](size_t b, size_t e) {
+		float g = L.gravity;
+		for (size_t i = b; i < e; ++i) {
+			size_t ip = i + 1, im = (i + n - 1) % n;
+			float ds = curve.arc[ip] - curve.arc[i];
+			ds += i ? curve.arc[i] - curve.arc[im] : length - curve.arc[im];
+			Pnt3f k = (curve.tangent[ip] - curve.tangent[im]) * (ds > 0 ? 1 / ds : 0);
+			const Pnt3f& up = curve.up[i];
+			Pnt3f side = curve.tangent[i] * up;
+			float kn = dot(k, up);
+			float kl = dot(k, side);
+
+			// what the riders feel is the push that bends them round the
+			// curve (v squared times the curvature) plus what holds them
+			// up against gravity
+			float c = L.maxSpeed * L.maxSpeed;
+			if (kn > 1e-6f)
+				c = fminf(c, (L.upMax * g - g * up.y) / kn);
+			else if (kn < -1e-6f)
+				c = fminf(c, (g * up.y - L.upMin * g) / -kn);
+			if (kl > 1e-6f)
+				c = fminf(c, (L.lateral * g - g * side.y) / kl);
+			else if (kl < -1e-6f)
+				c = fminf(c, (L.lateral * g + g * side.y) / -kl);
+			cap[i] = fmaxf(c, L.minSpeed * L.minSpeed);
+		}
+	});
+
+	start = 0;
+	for (size_t i = 1; i < n; ++i)
+		if (cap[i] < cap[start])
+			start = i;
+
+	w.resize(n + 1);
+	for (size_t j = 0; j <= n; ++j)
+		w[j] = cap[(start + j) % n];
+
+	pass(1, pool);
+	pass(-1, pool);
+
+	// back into the curve's order
+	limit.resize(n + 1);
+	speed.resize(n + 1);
+	lapTime = 0;
+	for (size_t j = 0; j < n; ++j) {
+		size_t i = (start + j) % n;
+		limit[i] = sqrtf(cap[i]);
+		speed[i] = sqrtf(w[j]);
+
+		// it speeds up (or slows down) evenly, so the time is the distance
+		// over the average of the speeds at the ends
+		float ds = along(j + 1) - along(j);
+		lapTime += 2 * ds / (sqrtf(w[j]) + sqrtf(w[j + 1]));
+	}
+	limit[n] = limit[0];
+	speed[n] = speed[0];
+
+	planTime = SimClock::now() - t0;
+}
+
+//****************************************************************************
+//
+// * one pass over w - forwards (dir 1, speeding up) or backwards (dir -1,
+//   braking). step k of the pass goes from entry at(k-1) to entry at(k)
+//============================================================================
+void SpeedPlanner::
+pass(int dir, WorkPool& pool)
+//============================================================================
+{
+	size_t n = w.size() - 1;
+	float a2 = 2 * limits.gravity * (dir > 0 ? limits.accel : limits.brake);
+	auto at = [n, dir](size_t k) { return dir > 0 ? k : n - k; };
+	auto dist = [&](size_t k0, size_t k1) { return fabsf(along(at(k1)) - along(at(k0))); };
+
+	// steps 1 to n, in chunks
+	size_t pieces = (n + chunkSize - 1) / chunkSize;
+	local.resize(n + 1);
+	enter.resize(pieces);
+
+	// each chunk on its own, as though it were entered as fast as can be
+	pool.parallelFor(n, chunkSize, [&](size_t b, size_t e) {
+		float v = w[at(b + 1)];
+		local[at(b + 1)] = v;
+		for (size_t k = b + 2; k <= e; ++k) {
+			float up = v + a2 * dist(k - 1, k);
+			float c = w[at(k)];
+			v = (up < c) ? up : c;
+			local[at(k)] = v;
+		}
+	});
+
+	// what each chunk is really entered with, one after the other
+	float x = w[at(0)];
+	for (size_t p = 0; p < pieces; ++p) {
+		size_t b = p * chunkSize;
+		size_t e = (b + chunkSize < n) ? b + chunkSize : n;
+		enter[p] = x;
+		float up = x + a2 * dist(b, e);
+		x = (up < local[at(e)]) ? up : local[at(e)];
+	}
+
+	// and fix them up
+	pool.parallelFor(n, chunkSize, [&](size_t b, size_t e) {
+		float in = enter[b / chunkSize];
+		for (size_t k = b + 1; k <= e; ++k) {
+			float up = in + a2 * dist(b, k);
+			float c = local[at(k)];
+			w[at(k)] = (up < c) ? up : c;
+		}
+	});
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+float SpeedPlanner::
+speedAt(float s, int& k) const
+//============================================================================
+{
+	int last = (int)arc.size() - 2;
+	if (last < 0 || length <= 0 || speed.size() != arc.size())
+		return limits.minSpeed;
+
+	s = fmodf(s, length);
+	if (s < 0) s += length;
+	if (k < 0 || k > last) k = 0;
+	while (k < last && arc[k + 1] <= s)
+		++k;
+	while (k > 0 && arc[k] > s)
+		--k;
+
+	float d = arc[k + 1] - arc[k];
+	float f = (d > 0) ? (s - arc[k]) / d : 0;
+	return speed[k] + f * (speed[k + 1] - speed[k]);
+}
@@ -0,0 +1,554 @@
+/************************************************************************
+     File:        TrackArchive.cpp
+
+     Comment:     Lots of revisions of a track, small
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "TrackArchive.H"
+#include "Varint.H"
+#include "SimClock.H"
+
+static const char	magic[4] = { 'T', 'R', 'K', 'Z' };
+static const size_t	blockBytes = 64 * 1024;
+enum { RevisionRecord = 'R' };
+
+// the zlib side of an archive, either way
+struct ArchiveStream {
+	ArchiveStream()
+		: file(0), in(blockBytes), out(blockBytes), at(0), have(0),
+		  ended(true), bad(false), damaged(false)
+	{
+		memset(&z, 0, sizeof(z));
+	}
+
+	bool refill();
+	unsigned char byte()
+	{
+		if (at == have && !refill()) {
+			bad = true;
+			return 0;
+		}
+		return out[at++];
+	}
+
+	z_stream					z;
+	FILE*						file;		// when reading
+	std::vector<unsigned char>	in;
+	std::vector<unsigned char>	out;
+	size_t						at;			// the next byte of out
+	size_t						have;		// and how many there are
+	bool						ended;		// between zlib streams
+	bool						bad;		// read past the end
+	bool						damaged;
+};
+
+//****************************************************************************
+//
+// * inflate the next block. false at the end of the last zlib stream, or
+//   if the data is wrong (then it's damaged)
+//============================================================================
+bool ArchiveStream::
+refill()
+//============================================================================
+{
+	for (;;) {
+		if (!z.avail_in && !feof(file)) {
+			z.next_in = &in[0];
+			z.avail_in = (uInt)fread(&in[0], 1, in.size(), file);
+		}
+		if (!z.avail_in) {
+			if (!ended)
+				damaged = true;		// the file stops part way through
+			return false;
+		}
+
+		// another stream starts where the last one ended
+		if (ended) {
+			inflateReset(&z);
+			ended = false;
+		}
+
+		z.next_out = &out[0];
+		z.avail_out = (uInt)out.size();
+		int r = inflate(&z, Z_NO_FLUSH);
+		if (r == Z_STREAM_END)
+			ended = true;
+		else if (r != Z_OK && r != Z_BUF_ERROR) {
+			damaged = true;
+			return false;
+		}
+		at = 0;
+		have = out.size() - z.avail_out;
+		if (have)
+			return true;
+	}
+}
+
+//****************************************************************************
+//
+// * orientations - the octahedral mapping, with y up. the middle of the
+//   square is straight up, exactly
+//============================================================================
+static inline float sign(float x)
+{
+	return (x >= 0) ? 1.0f : -1.0f;
+}
+static void octEncode(const Pnt3f& n, int bits, long long& u, long long& v)
+{
+	float most = (float)((1 << (bits - 1)) - 1);
+	float s = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	float a = (s > 0) ? n.x / s : 0;
+	float b = (s > 0) ? n.z / s : 0;
+	if (n.y < 0) {
+		float fa = (1 - fabsf(b)) * sign(a);
+		float fb = (1 - fabsf(a)) * sign(b);
+		a = fa;
+		b = fb;
+	}
+	u = lroundf(a * most);
+	v = lroundf(b * most);
+}
+static Pnt3f octDecode(long long u, long long v, int bits)
+{
+	float most = (float)((1 << (bits - 1)) - 1);
+	float a = u / most, b = v / most;
+	float y = 1 - fabsf(a) - fabsf(b);
+	if (y < 0) {
+		float fa = (1 - fabsf(b)) * sign(a);
+		float fb = (1 - fabsf(a)) * sign(b);
+		a = fa;
+		b = fb;
+	}
+	Pnt3f n(a, y, b);
+	n.normalize();
+	return n;
+}
+
+static unsigned bits(float f)
+{
+	unsigned u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+ArchiveWriter::Options::
+Options()
+	: precision(.001f), orientBits(12), level(6)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+ArchiveWriter::
+ArchiveWriter()
+	: rawBytes(0), archiveBytes(0), appending(0), fp(0), ok(false)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+ArchiveWriter::
+~ArchiveWriter()
+//============================================================================
+{
+	if (stream)
+		deflateEnd(&stream->z);
+	if (appending)
+		fclose(appending);
+}
+
+//****************************************************************************
+//
+// * a new archive goes through the SafeFile. what is added on to an old one
+//   is kept in memory (pending) until close(), so an archive that is never
+//   closed doesn't get half a stream on the end
+//============================================================================
+bool ArchiveWriter::
+open(const char* filename, const Options& o, bool append)
+//============================================================================
+{
+	options = o;
+	if (options.orientBits < 2) options.orientBits = 2;
+	if (options.orientBits > 16) options.orientBits = 16;
+	rawBytes = archiveBytes = 0;
+	record.clear();
+	pending.clear();
+	ok = false;
+
+	FILE* old = append ? fopen(filename, "rb") : 0;
+	if (old) {
+		char start[sizeof(magic)];
+		bool ours = fread(start, 1, sizeof(start), old) == sizeof(start) &&
+					!memcmp(start, magic, sizeof(magic));
+		fclose(old);
+		if (!ours)
+			return false;
+		appending = fopen(filename, "ab");
+		if (!appending)
+			return false;
+		fp = 0;
+	}
+	else {
+		if (!safe.open(filename))
+			return false;
+		fp = safe.file();
+		fwrite(magic, 1, sizeof(magic), fp);
+		archiveBytes = sizeof(magic);
+	}
+
+	stream.reset(new ArchiveStream);
+	if (deflateInit(&stream->z, options.level) != Z_OK) {
+		stream.reset();
+		return false;
+	}
+	ok = true;
+	return true;
+}
+
+//****************************************************************************
+//
+// * compress what is in the record (and finish the stream), out to the
+//   file - or onto pending, when appending
+//============================================================================
+bool ArchiveWriter::
+deflateOut(bool finish)
+//============================================================================
+{
+	ArchiveStream& s = *stream;
+	s.z.next_in = record.empty() ? 0 : &record[0];
+	s.z.avail_in = (uInt)record.size();
+
+	do {
+		s.z.next_out = &s.out[0];
+		s.z.avail_out = (uInt)s.out.size();
+		if (deflate(&s.z, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+			return false;
+		size_t n = s.out.size() - s.z.avail_out;
+		if (fp) {
+			if (n && fwrite(&s.out[0], 1, n, fp) != n)
+				return false;
+		}
+		else
+			pending.insert(pending.end(), s.out.begin(), s.out.begin() + n);
+		archiveBytes += n;
+	} while (!s.z.avail_out);
+	record.clear();
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool ArchiveWriter::
+add(const std::vector<ControlPoint>& points, const std::string& label)
+//============================================================================
+{
+	if (!ok || !stream)
+		return false;
+
+	record.push_back(RevisionRecord);
+	putVarint(record, label.size());
+	record.insert(record.end(), label.begin(), label.end());
+	putVarint(record, points.size());
+	putVarint(record, bits(options.precision));
+	putVarint(record, options.orientBits);
+
+	double scale = 1.0 / options.precision;
+	long long last[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < points.size(); ++i) {
+		const Pnt3f& p = points[i].pos;
+		long long q[3] = { llround(p.x * scale), llround(p.y * scale), llround(p.z * scale) };
+		for (int k = 0; k < 3; ++k) {
+			putSigned(record, q[k] - last[k]);
+			last[k] = q[k];
+		}
+	}
+	long long lastU = 0, lastV = 0;
+	for (size_t i = 0; i < points.size(); ++i) {
+		long long u, v;
+		octEncode(points[i].orient, options.orientBits, u, v);
+		putSigned(record, u - lastU);
+		putSigned(record, v - lastV);
+		lastU = u;
+		lastV = v;
+	}
+	rawBytes += points.size() * 6 * sizeof(float);
+
+	ok = deflateOut(false);
+	return ok;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool ArchiveWriter::
+close()
+//============================================================================
+{
+	if (!stream)
+		return false;
+
+	ok = deflateOut(true) && ok;
+	deflateEnd(&stream->z);
+	stream.reset();
+
+	if (appending) {
+		if (ok)
+			ok = pending.empty() ||
+				 fwrite(&pending[0], 1, pending.size(), appending) == pending.size();
+		pending.clear();
+		ok = !fclose(appending) && ok;
+		appending = 0;
+	}
+	else if (ok)
+		ok = safe.commit();
+	else
+		safe.abandon();
+	return ok;
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+ArchiveReader::
+ArchiveReader()
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+ArchiveReader::
+~ArchiveReader()
+//============================================================================
+{
+	close();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool ArchiveReader::
+open(const char* filename)
+//============================================================================
+{
+	close();
+	why.clear();
+
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) {
+		why = "Can't Open File!";
+		return false;
+	}
+	char start[sizeof(magic)];
+	if (fread(start, 1, sizeof(start), fp) != sizeof(start) ||
+		memcmp(start, magic, sizeof(magic))) {
+		fclose(fp);
+		why = "Not a track archive";
+		return false;
+	}
+
+	stream.reset(new ArchiveStream);
+	stream->file = fp;
+	if (inflateInit(&stream->z) != Z_OK) {
+		close();
+		why = "zlib wouldn't start";
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void ArchiveReader::
+close()
+//============================================================================
+{
+	if (stream) {
+		inflateEnd(&stream->z);
+		if (stream->file)
+			fclose(stream->file);
+		stream.reset();
+	}
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool ArchiveReader::
+next(std::vector<ControlPoint>& points, std::string& label)
+//============================================================================
+{
+	if (!stream)
+		return false;
+	ArchiveStream& s = *stream;
+
+	unsigned char tag = s.byte();
+	if (s.bad) {
+		if (s.damaged)
+			why = "The archive is damaged";
+		return false;
+	}
+
+	unsigned long long n = (tag == RevisionRecord) ? readVarint(s) : 0;
+	if (tag != RevisionRecord || n > (1 << 20)) {
+		why = "The archive is damaged";
+		return false;
+	}
+	label.resize((size_t)n);
+	for (size_t i = 0; i < n; ++i)
+		label[i] = (char)s.byte();
+
+	unsigned long long count = readVarint(s);
+	unsigned u = (unsigned)readVarint(s);
+	float precision;
+	memcpy(&precision, &u, sizeof(precision));
+	int orientBits = (int)readVarint(s);
+	if (s.bad || count > (1 << 28) || !(precision > 0) || orientBits < 2 || orientBits > 16) {
+		why = "The archive is damaged";
+		return false;
+	}
+
+	points.resize((size_t)count);
+	long long q[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < count; ++i) {
+		for (int k = 0; k < 3; ++k)
+			q[k] += unzigzag(readVarint(s));
+		points[i].pos = Pnt3f((float)(q[0] * (double)precision), (float)(q[1] * (double)precision),
+							  (float)(q[2] * (double)precision));
+	}
+	long long ou = 0, ov = 0;
+	for (size_t i = 0; i < count; ++i) {
+		ou += unzigzag(readVarint(s));
+		ov += unzigzag(readVarint(s));
+		points[i].orient = octDecode(ou, ov, orientBits);
+	}
+
+	if (s.bad) {
+		why = "The archive is damaged";
+		return false;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void
+reportArchive(size_t revisions, size_t n)
+//============================================================================
+{
+	// a long track that leans in places, then someone edits it: a few
+	// points move a little each time
+	std::vector<ControlPoint> track(n);
+	for (size_t i = 0; i < n; ++i) {
+		float a = 6.2831853f * i / n;
+		track[i].pos = Pnt3f(300 * cosf(a), 40 + 30 * sinf(17 * a), 300 * sinf(a));
+		Pnt3f o(0, 1, 0);
+		if ((i / 50) % 4 == 1) {
+			o = Pnt3f(.3f * sinf(a * 40), 1, 0);
+			o.normalize();
+		}
+		track[i].orient = o;
+	}
+
+	const char* filename = "archive-bench.trz";
+	ArchiveWriter::Options options;
+	ArchiveWriter writer;
+	std::vector<std::vector<ControlPoint> > kept;		// a few to check against
+	unsigned seed = 12345;
+	double t0 = SimClock::now();
+	if (!writer.open(filename, options)) {
+		printf("Can't write %s\n", filename);
+		return;
+	}
+	for (size_t r = 0; r < revisions; ++r) {
+		for (int k = 0; k < 3; ++k) {
+			seed = seed * 1103515245 + 12345;
+			ControlPoint& c = track[(seed >> 8) % n];
+			c.pos.y += ((seed >> 4) % 200) / 37.0f - 2.7f;
+		}
+		char label[32];
+		sprintf(label, "revision %lu", (unsigned long)r);
+		writer.add(track, label);
+		if (r % 97 == 0)
+			kept.push_back(track);
+	}
+	if (!writer.close()) {
+		printf("Can't write %s\n", filename);
+		return;
+	}
+	double encodeTime = SimClock::now() - t0;
+
+	// read it all back, one revision at a time
+	ArchiveReader reader;
+	std::vector<ControlPoint> points;
+	std::string label;
+	size_t read = 0;
+	float worstPos = 0, worstAngle = 0;
+	t0 = SimClock::now();
+	double checking = 0;
+	reader.open(filename);
+	while (reader.next(points, label)) {
+		if (read % 97 == 0 && read / 97 < kept.size()) {
+			double c0 = SimClock::now();
+			const std::vector<ControlPoint>& want = kept[read / 97];
+			for (size_t i = 0; i < n && i < points.size(); ++i) {
+				Pnt3f d = points[i].pos - want[i].pos;
+				worstPos = fmaxf(worstPos, fmaxf(fabsf(d.x), fmaxf(fabsf(d.y), fabsf(d.z))));
+				const Pnt3f& a = points[i].orient;
+				const Pnt3f& b = want[i].orient;
+				float cosine = a.x * b.x + a.y * b.y + a.z * b.z;
+				worstAngle = fmaxf(worstAngle, acosf(fminf(cosine, 1)) * 57.29578f);
+			}
+			checking += SimClock::now() - c0;
+		}
+		++read;
+	}
+	double decodeTime = SimClock::now() - t0 - checking;
+	if (!reader.why.empty() || read != revisions) {
+		printf("only read %lu of %lu revisions: %s\n", (unsigned long)read,
+			   (unsigned long)revisions, reader.why.c_str());
+		return;
+	}
+
+	double mb = writer.rawBytes / 1048576.0;
+	printf("%lu revisions of %lu points (precision %g, %d bit orientations)\n",
+		   (unsigned long)revisions, (unsigned long)n, options.precision, options.orientBits);
+	printf("  %.1f MB of floats came to %.2f MB - %.1f to 1\n", mb,
+		   writer.archiveBytes / 1048576.0, (double)writer.rawBytes / writer.archiveBytes);
+	printf("  writing: %.0f ms, %.0f MB/s\n", encodeTime * 1000, mb / encodeTime);
+	printf("  reading: %.0f ms, %.0f MB/s, %.0f revisions/s\n", decodeTime * 1000,
+		   mb / decodeTime, revisions / decodeTime);
+	printf("  off by up to %g in position, %.3f degrees in orientation\n",
+		   worstPos, worstAngle);
+
+	remove(filename);
+}
@@ -0,0 +1,268 @@
+/************************************************************************
+     File:        TrackCache.cpp
+
+     Comment:     The sampled curve, kept in a file next to the track
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "TrackCache.H"
+#include "MappedFile.H"
+#include "SafeFile.H"
+#include "SimClock.H"
+#include "TrackFile.H"
+
+static_assert(sizeof(CurveCacheHeader) == 76, "the header is part of the file format");
+static_assert(sizeof(ControlPoint) == 6 * sizeof(float), "points are copied as floats");
+static_assert(sizeof(Pnt3f) == 3 * sizeof(float), "samples are copied as floats");
+static_assert(sizeof(TrackCurve::Chunk) == 8 + 6 * sizeof(float), "chunks are copied whole");
+
+static const char magic[4] = { 'T', 'R', 'K', 'C' };
+
+static inline size_t align16(size_t n)
+{
+	return (n + 15) & ~(size_t)15;
+}
+
+//****************************************************************************
+//
+// * the key: the points, then the settings
+//============================================================================
+static uint32_t keyOf(const std::vector<ControlPoint>& points, int type,
+					  int samplesPerSegment, int chunkSize, bool closed)
+{
+	int32_t settings[4] = { type, samplesPerSegment, chunkSize, closed ? 1 : 0 };
+	uint32_t crc = points.empty() ? 0 : crcOf(&points[0], points.size() * sizeof(ControlPoint));
+	return crcOf(settings, sizeof(settings), crc);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+std::string
+curveCacheName(const char* trackFile)
+//============================================================================
+{
+	return std::string(trackFile) + ".curve";
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+std::string
+curveCacheTrack(const char* sidecar)
+//============================================================================
+{
+	size_t len = strlen(sidecar);
+	if (len <= 6 || strcmp(sidecar + len - 6, ".curve"))
+		return "";
+	return std::string(sidecar, len - 6);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+readCurveCache(const char* filename, const std::vector<ControlPoint>& points, int type,
+			   TrackCurve& curve, int samplesPerSegment, int chunkSize, bool closed)
+//============================================================================
+{
+	// the same as build() does
+	closed = closed || points.size() < 4;
+
+	MappedFile file;
+	if (!file.open(filename) || file.size() < sizeof(CurveCacheHeader))
+		return false;
+	const unsigned char* data = file.data();
+	size_t size = file.size();
+
+	CurveCacheHeader h;
+	memcpy(&h, data, sizeof(h));
+	if (memcmp(h.magic, magic, sizeof(magic)) || h.version != CurveCacheHeader::Version ||
+		h.nPoints != points.size() || h.type != type ||
+		h.samplesPerSegment != samplesPerSegment || h.chunkSize != chunkSize ||
+		h.closed != (closed ? 1u : 0u) ||
+		h.key != keyOf(points, type, samplesPerSegment, chunkSize, closed))
+		return false;
+
+	// every array has to be all there
+	size_t ns = h.nSamples;
+	size_t sample = 3 * sizeof(float);
+	if ((size_t)h.points + points.size() * sizeof(ControlPoint) > size ||
+		(size_t)h.pos + ns * sample > size ||
+		(size_t)h.tangent + ns * sample > size ||
+		(size_t)h.up + ns * sample > size ||
+		(size_t)h.arc + ns * sizeof(float) > size ||
+		(size_t)h.chunks + h.nChunks * sizeof(TrackCurve::Chunk) > size)
+		return false;
+
+	// the key only says they are probably the same points
+	if (!points.empty() &&
+		memcmp(data + h.points, &points[0], points.size() * sizeof(ControlPoint)))
+		return false;
+
+	curve.type = type;
+	curve.samplesPerSegment = samplesPerSegment;
+	curve.chunkSize = chunkSize;
+	curve.nSegments = h.nSegments;
+	curve.closed = closed;
+	curve.length = h.length;
+	curve.pos.resize(ns);
+	curve.tangent.resize(ns);
+	curve.up.resize(ns);
+	curve.arc.resize(ns);
+	curve.chunks.resize(h.nChunks);
+	if (ns) {
+		memcpy(&curve.pos[0], data + h.pos, ns * sample);
+		memcpy(&curve.tangent[0], data + h.tangent, ns * sample);
+		memcpy(&curve.up[0], data + h.up, ns * sample);
+		memcpy(&curve.arc[0], data + h.arc, ns * sizeof(float));
+	}
+	if (h.nChunks)
+		memcpy(&curve.chunks[0], data + h.chunks, h.nChunks * sizeof(TrackCurve::Chunk));
+	curve.serial = TrackCurve::nextSerial();
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+writeCurveCache(const char* filename, const std::vector<ControlPoint>& points,
+				const TrackCurve& curve, int chunkSize)
+//============================================================================
+{
+	size_t ns = curve.size();
+	size_t sample = 3 * sizeof(float);
+
+	CurveCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = CurveCacheHeader::Version;
+	h.key = keyOf(points, curve.type, curve.samplesPerSegment, chunkSize, curve.closed);
+	h.nPoints = (uint32_t)points.size();
+	h.nSamples = (uint32_t)ns;
+	h.nChunks = (uint32_t)curve.chunks.size();
+	h.type = curve.type;
+	h.samplesPerSegment = curve.samplesPerSegment;
+	h.chunkSize = chunkSize;
+	h.closed = curve.closed ? 1 : 0;
+	h.nSegments = (uint32_t)curve.nSegments;
+	h.length = curve.length;
+
+	size_t at = align16(sizeof(h));
+	size_t offsets[6];
+	size_t bytes[6] = {
+		points.size() * sizeof(ControlPoint), ns * sample, ns * sample, ns * sample,
+		ns * sizeof(float), curve.chunks.size() * sizeof(TrackCurve::Chunk)
+	};
+	for (int k = 0; k < 6; ++k) {
+		offsets[k] = at;
+		at = align16(at + bytes[k]);
+	}
+	if (at > 0xffffffffu)
+		return false;			// too big for the offsets
+	h.points = (uint32_t)offsets[0];
+	h.pos = (uint32_t)offsets[1];
+	h.tangent = (uint32_t)offsets[2];
+	h.up = (uint32_t)offsets[3];
+	h.arc = (uint32_t)offsets[4];
+	h.chunks = (uint32_t)offsets[5];
+
+	const void* arrays[6] = {
+		points.empty() ? 0 : &points[0],
+		ns ? &curve.pos[0] : 0, ns ? &curve.tangent[0] : 0, ns ? &curve.up[0] : 0,
+		ns ? &curve.arc[0] : 0, curve.chunks.empty() ? 0 : &curve.chunks[0]
+	};
+
+	SafeFile file;
+	if (!file.open(filename))
+		return false;
+	FILE* fp = file.file();
+	static const char zeros[16] = { 0 };
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+	size_t written = sizeof(h);
+	for (int k = 0; k < 6 && ok; ++k) {
+		ok = fwrite(zeros, 1, offsets[k] - written, fp) == offsets[k] - written;
+		if (ok && bytes[k])
+			ok = fwrite(arrays[k], 1, bytes[k], fp) == bytes[k];
+		written = offsets[k] + bytes[k];
+	}
+	return ok && file.commit();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void
+reportCurveCache(size_t n)
+//============================================================================
+{
+	std::vector<ControlPoint> points(n);
+	for (size_t i = 0; i < n; ++i) {
+		float a = 6.2831853f * i / n;
+		points[i].pos = Pnt3f(300 * cosf(a), 40 + 30 * sinf(17 * a), 300 * sinf(a));
+		Pnt3f o(.2f * sinf(5 * a), 1, .2f * cosf(3 * a));
+		o.normalize();
+		points[i].orient = o;
+	}
+
+	const char* filename = "curvecache-bench.txt.curve";
+	double t0 = SimClock::now();
+	TrackCurve built;
+	built.build(points, TrackCurve::Cardinal);
+	double buildTime = SimClock::now() - t0;
+
+	t0 = SimClock::now();
+	if (!writeCurveCache(filename, points, built)) {
+		printf("Can't write %s\n", filename);
+		return;
+	}
+	double writeTime = SimClock::now() - t0;
+
+	t0 = SimClock::now();
+	TrackCurve cached;
+	bool hit = readCurveCache(filename, points, TrackCurve::Cardinal, cached);
+	double readTime = SimClock::now() - t0;
+
+	bool same = hit && cached.size() == built.size() && cached.chunks.size() == built.chunks.size() &&
+				cached.length == built.length &&
+				!memcmp(&cached.pos[0], &built.pos[0], built.size() * sizeof(Pnt3f)) &&
+				!memcmp(&cached.up[0], &built.up[0], built.size() * sizeof(Pnt3f)) &&
+				!memcmp(&cached.arc[0], &built.arc[0], built.size() * sizeof(float));
+
+	// a moved point, or another spline, mustn't use it
+	std::vector<ControlPoint> moved = points;
+	moved[n / 2].pos.y += .001f;
+	TrackCurve other;
+	bool stale = readCurveCache(filename, moved, TrackCurve::Cardinal, other) ||
+				 readCurveCache(filename, points, TrackCurve::BSpline, other);
+
+	FILE* fp = fopen(filename, "rb");
+	long size = 0;
+	if (fp) {
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fclose(fp);
+	}
+
+	printf("%lu points, %lu samples, %lu chunks (a %.1f MB sidecar)\n", (unsigned long)n,
+		   (unsigned long)built.size(), (unsigned long)built.chunks.size(), size / 1048576.0);
+	printf("  building the curve:  %8.2f ms\n", buildTime * 1000);
+	printf("  writing the sidecar: %8.2f ms\n", writeTime * 1000);
+	printf("  reading it back:     %8.2f ms - %.0f times faster\n", readTime * 1000,
+		   buildTime / readTime);
+	printf("  the curve is %s, and edits %s\n", same ? "exactly the same" : "DIFFERENT",
+		   stale ? "USE IT ANYWAY" : "build it again");
+
+	remove(filename);
+}
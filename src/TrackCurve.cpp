@@ -0,0 +1,370 @@
+/************************************************************************
+     File:        TrackCurve.cpp
+
+     Comment:     The track, tessellated
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#include "TrackCurve.H"
+
+//****************************************************************************
+//
+// * small vector helpers that Pnt3f doesn't have
+//============================================================================
+static inline float dot(const Pnt3f& a, const Pnt3f& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+static inline float norm(const Pnt3f& a)
+{
+	return sqrtf(dot(a, a));
+}
+
+//****************************************************************************
+//
+// * the four blending weights (and their derivatives) for a segment, for
+//   points i-1, i, i+1, i+2. the cardinal spline uses tension 1/2
+//   (Catmull-Rom)
+//============================================================================
+static void basis(int type, float t, float w[4], float dw[4])
+//============================================================================
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+
+	switch (type) {
+		case TrackCurve::Cardinal: {
+			const float s = .5f;
+			w[0] = -s * t3 + 2 * s * t2 - s * t;
+			w[1] = (2 - s) * t3 + (s - 3) * t2 + 1;
+			w[2] = (s - 2) * t3 + (3 - 2 * s) * t2 + s * t;
+			w[3] = s * t3 - s * t2;
+			dw[0] = -3 * s * t2 + 4 * s * t - s;
+			dw[1] = 3 * (2 - s) * t2 + 2 * (s - 3) * t;
+			dw[2] = 3 * (s - 2) * t2 + 2 * (3 - 2 * s) * t + s;
+			dw[3] = 3 * s * t2 - 2 * s * t;
+			break;
+		}
+		case TrackCurve::BSpline: {
+			float it = 1 - t;
+			w[0] = it * it * it / 6;
+			w[1] = (3 * t3 - 6 * t2 + 4) / 6;
+			w[2] = (-3 * t3 + 3 * t2 + 3 * t + 1) / 6;
+			w[3] = t3 / 6;
+			dw[0] = -it * it / 2;
+			dw[1] = (9 * t2 - 12 * t) / 6;
+			dw[2] = (-9 * t2 + 6 * t + 3) / 6;
+			dw[3] = t2 / 2;
+			break;
+		}
+		default:	// linear
+			w[0] = 0;	w[1] = 1 - t;	w[2] = t;	w[3] = 0;
+			dw[0] = 0;	dw[1] = -1;		dw[2] = 1;	dw[3] = 0;
+			break;
+	}
+}
+
+// hands out TrackCurve::serial (curves get built on more than one thread)
+static std::atomic<unsigned long> buildCount(0);
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+TrackCurve::
+TrackCurve()
+	: type(Linear), samplesPerSegment(0), chunkSize(0), nSegments(0), length(0), closed(true),
+	  serial(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+unsigned long TrackCurve::
+nextSerial()
+//============================================================================
+{
+	return ++buildCount;
+}
+
+//****************************************************************************
+//
+// * evaluate the curve at parameter u
+//============================================================================
+void TrackCurve::
+evaluate(const std::vector<ControlPoint>& points, int type, float u,
+		 Pnt3f& p, Pnt3f& d, Pnt3f& o)
+//============================================================================
+{
+	size_t n = points.size();
+	float fn = (float)n;
+	u = fmodf(u, fn);
+	if (u < 0) u += fn;
+
+	size_t i = (size_t)u;
+	if (i >= n) i = n - 1;
+	float t = u - (float)i;
+
+	const ControlPoint& c0 = points[(i + n - 1) % n];
+	const ControlPoint& c1 = points[i];
+	const ControlPoint& c2 = points[(i + 1) % n];
+	const ControlPoint& c3 = points[(i + 2) % n];
+
+	float w[4], dw[4];
+	basis(type, t, w, dw);
+
+	p = w[0] * c0.pos + w[1] * c1.pos + w[2] * c2.pos + w[3] * c3.pos;
+	d = dw[0] * c0.pos + dw[1] * c1.pos + dw[2] * c2.pos + dw[3] * c3.pos;
+	o = w[0] * c0.orient + w[1] * c1.orient + w[2] * c2.orient + w[3] * c3.orient;
+}
+
+//****************************************************************************
+//
+// * one sample: where it is, which way it goes and which way is up
+//============================================================================
+void TrackCurve::
+sampleAt(const std::vector<ControlPoint>& points, size_t i, float start, Pnt3f& lastTangent)
+//============================================================================
+{
+	float u = start + ((float)i) / ((float)samplesPerSegment);
+	Pnt3f d, o;
+	evaluate(points, type, u, pos[i], d, o);
+
+	// if the curve stops (two points on top of each other) keep going
+	// the way we were going
+	float dl = norm(d);
+	Pnt3f t = (dl > 1e-6f) ? d * (1 / dl) : lastTangent;
+	lastTangent = t;
+
+	// up is the orientation, with the part along the tangent removed
+	Pnt3f v = o - t * dot(o, t);
+	v.normalize();
+
+	tangent[i] = t;
+	up[i] = v;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackCurve::
+box(Chunk& c) const
+//============================================================================
+{
+	c.lo = c.hi = pos[c.first];
+	for (int j = 1; j <= c.count; ++j) {
+		const Pnt3f& q = pos[c.first + j];
+		if (q.x < c.lo.x) c.lo.x = q.x;
+		if (q.y < c.lo.y) c.lo.y = q.y;
+		if (q.z < c.lo.z) c.lo.z = q.z;
+		if (q.x > c.hi.x) c.hi.x = q.x;
+		if (q.y > c.hi.y) c.hi.y = q.y;
+		if (q.z > c.hi.z) c.hi.z = q.z;
+	}
+}
+
+//****************************************************************************
+//
+// * sample the whole loop, then chop it into chunks
+//============================================================================
+void TrackCurve::
+build(const std::vector<ControlPoint>& points, int _type,
+	  int _samplesPerSegment, int _chunkSize, bool _closed)
+//============================================================================
+{
+	serial = nextSerial();
+	type = _type;
+	samplesPerSegment = _samplesPerSegment;
+	chunkSize = _chunkSize;
+	closed = _closed || points.size() < 4;
+	nSegments = closed ? points.size() : points.size() - 3;
+
+	// an open curve starts at the second point, and its last sample isn't
+	// the first one
+	float start = closed ? 0.f : 1.f;
+	size_t ns = nSegments * samplesPerSegment;
+	size_t last = closed ? ns : ns + 1;
+	pos.resize(ns + 1);
+	tangent.resize(ns + 1);
+	up.resize(ns + 1);
+	arc.resize(ns + 1);
+
+	Pnt3f lastTangent(1, 0, 0);
+	for (size_t i = 0; i < last; ++i)
+		sampleAt(points, i, start, lastTangent);
+	if (closed) {
+		pos[ns] = pos[0];
+		tangent[ns] = tangent[0];
+		up[ns] = up[0];
+	}
+
+	arc[0] = 0;
+	for (size_t i = 1; i <= ns; ++i)
+		arc[i] = arc[i - 1] + norm(pos[i] - pos[i - 1]);
+	length = arc[ns];
+
+	// the chunks
+	chunks.clear();
+	for (size_t first = 0; first < ns; first += chunkSize) {
+		Chunk c;
+		c.first = (int)first;
+		c.count = (int)((first + chunkSize <= ns) ? chunkSize : ns - first);
+		box(c);
+		chunks.push_back(c);
+	}
+}
+
+//****************************************************************************
+//
+// * segment k (from point k to k+1) is made from points k-1 to k+2, so a
+//   point reaches back two segments and forward one - one more each way
+//   here, for the samples right on a segment's end (u rounds either way)
+//============================================================================
+bool TrackCurve::
+update(const TrackCurve& old, const std::vector<ControlPoint>& oldPoints,
+	   const std::vector<ControlPoint>& points)
+//============================================================================
+{
+	size_t n = points.size();
+	if (n != oldPoints.size() || n < 4 || old.pos.empty() || old.chunkSize <= 0)
+		return false;
+
+	// which segments (by the point they start at) need sampling again
+	std::vector<unsigned char> dirty(n, 0);
+	size_t changed = 0;
+	for (size_t j = 0; j < n; ++j) {
+		if (!memcmp(&points[j], &oldPoints[j], sizeof(ControlPoint)))
+			continue;
+		if (++changed * 4 > n)
+			return false;		// most of it - build() is as quick
+		for (int d = -3; d <= 2; ++d)
+			dirty[(j + n + d) % n] = 1;
+	}
+
+	*this = old;
+	serial = nextSerial();
+	if (!changed)
+		return true;
+
+	float start = closed ? 0.f : 1.f;
+	size_t sps = samplesPerSegment;
+	size_t ns = nSegments * sps;
+	size_t last = closed ? ns : ns + 1;
+	size_t firstChanged = ns + 1;
+	std::vector<unsigned char> resampled(ns + 1, 0);
+	for (size_t s = 0; s * sps < last; ++s) {
+		if (!dirty[(s + (size_t)start) % n])
+			continue;
+		size_t e = (s + 1) * sps < last ? (s + 1) * sps : last;
+		Pnt3f lastTangent = s ? tangent[s * sps - 1] : Pnt3f(1, 0, 0);
+		for (size_t i = s * sps; i < e; ++i) {
+			sampleAt(points, i, start, lastTangent);
+			resampled[i] = 1;
+		}
+		if (s * sps < firstChanged)
+			firstChanged = s * sps;
+	}
+	if (closed && resampled[0]) {
+		pos[ns] = pos[0];
+		tangent[ns] = tangent[0];
+		up[ns] = up[0];
+		resampled[ns] = 1;
+	}
+	if (firstChanged > ns)
+		return true;
+
+	// the arc lengths after the first change all move
+	for (size_t i = firstChanged ? firstChanged : 1; i <= ns; ++i)
+		arc[i] = arc[i - 1] + norm(pos[i] - pos[i - 1]);
+	length = arc[ns];
+
+	for (size_t k = 0; k < chunks.size(); ++k) {
+		Chunk& c = chunks[k];
+		for (int j = 0; j <= c.count; ++j) {
+			if (resampled[c.first + j]) {
+				box(c);
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+float TrackCurve::
+arcAt(float u) const
+//============================================================================
+{
+	if (arc.size() < 2)
+		return 0;
+	int last = (int)arc.size() - 2;
+	float x = u * samplesPerSegment;
+	int k = (int)floorf(x);
+	if (k < 0) k = 0;
+	if (k > last) k = last;
+	float f = x - k;
+	return arc[k] + f * (arc[k + 1] - arc[k]);
+}
+
+//****************************************************************************
+//
+// * first find the sample before each s (sorted, so the search only ever
+//   moves forward), then blend. the blending is a plain loop over arrays
+//   with no branches, which the compiler can vectorize
+//============================================================================
+void TrackCurve::
+frames(const float* s, size_t n, Pnt3f* outPos, Pnt3f* outTangent, Pnt3f* outUp) const
+//============================================================================
+{
+	if (!n || arc.size() < 2)
+		return;
+	int last = (int)arc.size() - 2;
+
+	std::vector<int> order(n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = (int)i;
+	std::sort(order.begin(), order.end(),
+			  [s](int a, int b) { return s[a] < s[b]; });
+
+	std::vector<int> at(n);
+	std::vector<float> f(n);
+	int k = (int)(std::upper_bound(arc.begin(), arc.end(), s[order[0]]) - arc.begin()) - 1;
+	if (k < 0) k = 0;
+	for (size_t j = 0; j < n; ++j) {
+		int i = order[j];
+		while (k < last && arc[k + 1] <= s[i])
+			++k;
+		float d = arc[k + 1] - arc[k];
+		float t = (d > 0) ? (s[i] - arc[k]) / d : 0;
+		at[i] = k;
+		f[i] = (t < 0) ? 0 : ((t > 1) ? 1 : t);
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		int a = at[i];
+		float t = f[i];
+		outPos[i] = pos[a] + (pos[a + 1] - pos[a]) * t;
+
+		Pnt3f tg = tangent[a] + (tangent[a + 1] - tangent[a]) * t;
+		tg.normalize();
+		Pnt3f v = up[a] + (up[a + 1] - up[a]) * t;
+		v = v - tg * dot(v, tg);
+		v.normalize();
+		outTangent[i] = tg;
+		outUp[i] = v;
+	}
+}
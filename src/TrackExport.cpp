@@ -0,0 +1,570 @@
+/************************************************************************
+     File:        TrackExport.cpp
+
+     Comment:     Getting the track's geometry out, for other programs
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TrackExport.H"
+#include "SafeFile.H"
+#include "SimClock.H"
+#include "Track.H"
+
+enum Format { Obj, Ply, Gltf };
+
+static const int	chunksPerJob = 16;
+static const size_t	blockBytes = 1 << 20;
+
+//****************************************************************************
+//
+// * little helpers for filling in the bytes. the binary formats are little
+//   endian, like everything this runs on
+//============================================================================
+static inline void put(std::vector<char>& out, const void* p, size_t n)
+{
+	const char* c = (const char*)p;
+	out.insert(out.end(), c, c + n);
+}
+
+// "what x y z"
+static void line(std::vector<char>& out, const char* what, const float* f)
+{
+	char buf[128];
+	size_t len = strlen(what);
+	memcpy(buf, what, len);
+	char* p = buf + len;
+	for (int k = 0; k < 3; ++k) {
+		*p++ = ' ';
+		p = std::to_chars(p, buf + sizeof(buf), f[k]).ptr;
+	}
+	*p++ = '\n';
+	out.insert(out.end(), buf, p);
+}
+
+// "what i j ..." with the vertex indices i, j, ... (each twice over, as
+// i//i, if both)
+static void indices(std::vector<char>& out, const char* what, const long long* i, int n,
+					bool both)
+{
+	out.insert(out.end(), what, what + strlen(what));
+	for (int k = 0; k < n; ++k) {
+		// " i//i" - a long long is 20 characters at most, with its sign
+		char buf[1 + 20 + 2 + 20];
+		char* end = buf + sizeof(buf);
+		char* p = buf;
+		*p++ = ' ';
+		std::to_chars_result r = std::to_chars(p, end, i[k]);
+		p = r.ptr;
+		if (both && r.ec == std::errc()) {
+			*p++ = '/';
+			*p++ = '/';
+			p = std::to_chars(p, end, i[k]).ptr;
+		}
+		out.insert(out.end(), buf, p);
+	}
+	out.push_back('\n');
+}
+
+static bool writeOut(FILE* fp, std::vector<char>& bytes)
+{
+	bool ok = bytes.empty() || fwrite(&bytes[0], 1, bytes.size(), fp) == bytes.size();
+	bytes.clear();
+	return ok;
+}
+
+//****************************************************************************
+//
+// * the ring of jobs, and the threads that make them
+//============================================================================
+class Exporter {
+	public:
+		// what one job makes: the bytes, just as they go in the file
+		struct Job {
+			std::vector<float>	verts;		// the mesh's, for a chunk
+			std::vector<char>	bytes;
+			size_t				nVerts;		// triangle corners
+			float				lo[3];
+			float				hi[3];
+			bool				ready;
+		};
+
+		Exporter(const TrackCurve& curve, const TrackMesh& mesh, Format format);
+
+		// make all of the jobs and write them out, in order
+		bool run(FILE* fp, std::string& why, Progress* progress);
+
+	public:
+		size_t		nVerts;			// triangle corners, in all
+		float		lo[3];			// and the box around them
+		float		hi[3];
+
+	private:
+		void work();
+		void make(size_t j, Job& job);
+
+		const TrackCurve&		curve;
+		const TrackMesh&		mesh;
+		Format					format;
+		size_t					nJobs;
+
+		std::vector<Job>		ring;
+		std::mutex				mutex;
+		std::condition_variable	changed;
+		std::atomic<size_t>		next;		// the next job to start
+		size_t					written;	// jobs written so far
+		bool					stop;
+};
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+Exporter::
+Exporter(const TrackCurve& c, const TrackMesh& m, Format f)
+	: nVerts(0), curve(c), mesh(m), format(f), next(0), written(0), stop(false)
+//============================================================================
+{
+	nJobs = (curve.chunks.size() + chunksPerJob - 1) / chunksPerJob;
+	for (int k = 0; k < 3; ++k) {
+		lo[k] = 1e30f;
+		hi[k] = -1e30f;
+	}
+}
+
+//****************************************************************************
+//
+// * the geometry for some chunks, in the file's format
+//============================================================================
+void Exporter::
+make(size_t j, Job& job)
+//============================================================================
+{
+	job.bytes.clear();
+	job.nVerts = 0;
+	for (int k = 0; k < 3; ++k) {
+		job.lo[k] = 1e30f;
+		job.hi[k] = -1e30f;
+	}
+
+	size_t first = j * chunksPerJob;
+	size_t last = first + chunksPerJob;
+	if (last > curve.chunks.size())
+		last = curve.chunks.size();
+
+	for (size_t c = first; c < last; ++c) {
+		int railVerts, railPrim;
+		mesh.geometry(curve, (int)c, 0, job.verts, railVerts, railPrim);
+		size_t n = job.verts.size() / 6;
+
+		for (size_t i = 0; i < n; ++i) {
+			float* v = &job.verts[i * 6];
+			float len = sqrtf(v[3] * v[3] + v[4] * v[4] + v[5] * v[5]);
+			if (len > 0) {
+				v[3] /= len;
+				v[4] /= len;
+				v[5] /= len;
+			}
+			for (int k = 0; k < 3; ++k) {
+				if (v[k] < job.lo[k]) job.lo[k] = v[k];
+				if (v[k] > job.hi[k]) job.hi[k] = v[k];
+			}
+		}
+
+		if (format == Obj) {
+			// the faces count back from the last vertex of the chunk
+			for (size_t i = 0; i < n; ++i)
+				line(job.bytes, "v", &job.verts[i * 6]);
+			for (size_t i = 0; i < n; ++i)
+				line(job.bytes, "vn", &job.verts[i * 6 + 3]);
+			for (size_t i = 0; i + 2 < n; i += 3) {
+				long long f[3] = { (long long)i - (long long)n, (long long)i + 1 - (long long)n,
+								   (long long)i + 2 - (long long)n };
+				indices(job.bytes, "f", f, 3, true);
+			}
+		}
+		else if (n)
+			put(job.bytes, &job.verts[0], n * 6 * sizeof(float));
+		job.nVerts += n;
+	}
+}
+
+//****************************************************************************
+//
+// * on a worker. the jobs are started in order, so the one the writer is
+//   waiting for has always been started (or is next)
+//============================================================================
+void Exporter::
+work()
+//============================================================================
+{
+	for (;;) {
+		size_t j = next++;
+		if (j >= nJobs)
+			return;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&] { return stop || j < written + ring.size(); });
+			if (stop)
+				return;
+		}
+
+		Job& job = ring[j % ring.size()];
+		make(j, job);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job.ready = true;
+		}
+		changed.notify_all();
+	}
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool Exporter::
+run(FILE* fp, std::string& why, Progress* progress)
+//============================================================================
+{
+	int nThreads = (int)std::thread::hardware_concurrency();
+	if (nThreads < 1)
+		nThreads = 1;
+	ring.resize(nThreads * 2);
+	for (size_t i = 0; i < ring.size(); ++i)
+		ring[i].ready = false;
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nThreads; ++t)
+		threads.push_back(std::thread(&Exporter::work, this));
+
+	bool ok = true;
+	for (size_t j = 0; j < nJobs && ok; ++j) {
+		Job& job = ring[j % ring.size()];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&] { return job.ready; });
+		}
+
+		if (!writeOut(fp, job.bytes)) {
+			why = "Couldn't write all of the file";
+			ok = false;
+		}
+		nVerts += job.nVerts;
+		for (int k = 0; k < 3; ++k) {
+			if (job.lo[k] < lo[k]) lo[k] = job.lo[k];
+			if (job.hi[k] > hi[k]) hi[k] = job.hi[k];
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job.ready = false;
+			written = j + 1;
+		}
+		changed.notify_all();
+
+		if (progress) {
+			progress->done = (float)(j + 1) / nJobs;
+			if (progress->cancelled()) {
+				why = "Cancelled";
+				ok = false;
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	changed.notify_all();
+	for (size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+	return ok;
+}
+
+//****************************************************************************
+//
+// * the center line, after the triangles: positions, with up for the
+//   normal. the indices are filled in by each format
+//============================================================================
+static bool writeCenterLine(FILE* fp, const TrackCurve& curve, Format format)
+{
+	std::vector<char> bytes;
+	bool ok = true;
+	size_t n = curve.size();
+	if (format == Obj)
+		put(bytes, "o center_line\n", 14);
+	for (size_t i = 0; i < n && ok; ++i) {
+		if (format == Obj)
+			line(bytes, "v", &curve.pos[i].x);
+		else {
+			put(bytes, &curve.pos[i].x, 3 * sizeof(float));
+			put(bytes, &curve.up[i].x, 3 * sizeof(float));
+		}
+		if (bytes.size() >= blockBytes)
+			ok = writeOut(fp, bytes);
+	}
+	if (format == Obj) {
+		for (size_t i = 0; i + 1 < n && ok; ++i) {
+			long long e[2] = { (long long)i - (long long)n, (long long)i + 1 - (long long)n };
+			indices(bytes, "l", e, 2, false);
+			if (bytes.size() >= blockBytes)
+				ok = writeOut(fp, bytes);
+		}
+	}
+	return writeOut(fp, bytes) && ok;
+}
+
+//****************************************************************************
+//
+// * the .ply header - the counts are padded out, so that it is the same
+//   size with the real ones in at the end
+//============================================================================
+static void plyHeader(FILE* fp, size_t verts, size_t faces, size_t edges)
+{
+	fprintf(fp,
+			"ply\n"
+			"format binary_little_endian 1.0\n"
+			"comment a roller coaster track\n"
+			"element vertex %-12lu\n"
+			"property float x\n"
+			"property float y\n"
+			"property float z\n"
+			"property float nx\n"
+			"property float ny\n"
+			"property float nz\n"
+			"element face %-12lu\n"
+			"property list uchar int vertex_indices\n"
+			"element edge %-12lu\n"
+			"property int vertex1\n"
+			"property int vertex2\n"
+			"end_header\n",
+			(unsigned long)verts, (unsigned long)faces, (unsigned long)edges);
+}
+
+//****************************************************************************
+//
+// * the .ply's faces and edges - every three triangle corners in a row
+//   are a face, and the center line's vertices join up one to the next
+//============================================================================
+static bool plyIndices(FILE* fp, size_t nVerts, size_t nLine)
+{
+	std::vector<char> bytes;
+	bool ok = true;
+	unsigned char three = 3;
+	for (size_t i = 0; i + 2 < nVerts && ok; i += 3) {
+		int f[3] = { (int)i, (int)i + 1, (int)i + 2 };
+		put(bytes, &three, 1);
+		put(bytes, f, sizeof(f));
+		if (bytes.size() >= blockBytes)
+			ok = writeOut(fp, bytes);
+	}
+	for (size_t i = 0; i + 1 < nLine && ok; ++i) {
+		int e[2] = { (int)(nVerts + i), (int)(nVerts + i + 1) };
+		put(bytes, e, sizeof(e));
+		if (bytes.size() >= blockBytes)
+			ok = writeOut(fp, bytes);
+	}
+	return writeOut(fp, bytes) && ok;
+}
+
+//****************************************************************************
+//
+// * the .gltf that goes with the .bin: one mesh, with the triangles and the
+//   center line (a line strip) as two primitives, both out of one
+//   interleaved buffer view
+//============================================================================
+static void gltfAccessor(FILE* fp, size_t offset, size_t count,
+						 const float* lo, const float* hi, bool last)
+{
+	fprintf(fp, "    { \"bufferView\": 0, \"byteOffset\": %lu, \"componentType\": 5126, "
+				"\"count\": %lu, \"type\": \"VEC3\"",
+			(unsigned long)offset, (unsigned long)count);
+	if (lo)
+		fprintf(fp, ", \"min\": [ %.9g, %.9g, %.9g ], \"max\": [ %.9g, %.9g, %.9g ]",
+				lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+	fprintf(fp, " }%s\n", last ? "" : ",");
+}
+
+static void gltfFile(FILE* fp, const char* binName, size_t nVerts, const float* lo,
+					 const float* hi, const TrackCurve& curve)
+{
+	size_t nLine = curve.size();
+	float llo[3] = { 1e30f, 1e30f, 1e30f }, lhi[3] = { -1e30f, -1e30f, -1e30f };
+	for (size_t i = 0; i < nLine; ++i) {
+		const float* p = &curve.pos[i].x;
+		for (int k = 0; k < 3; ++k) {
+			if (p[k] < llo[k]) llo[k] = p[k];
+			if (p[k] > lhi[k]) lhi[k] = p[k];
+		}
+	}
+	size_t stride = 6 * sizeof(float);
+	size_t length = (nVerts + nLine) * stride;
+
+	// accessors 0 and 1 are the triangles, 2 and 3 the line (if there are
+	// any triangles - an accessor can't be empty)
+	int line = nVerts ? 2 : 0;
+	fprintf(fp, "{\n  \"asset\": { \"version\": \"2.0\", \"generator\": \"Roller Coaster\" },\n");
+	fprintf(fp, "  \"scene\": 0,\n  \"scenes\": [ { \"nodes\": [ 0 ] } ],\n");
+	fprintf(fp, "  \"nodes\": [ { \"mesh\": 0, \"name\": \"track\" } ],\n");
+	fprintf(fp, "  \"meshes\": [ { \"primitives\": [\n");
+	if (nVerts)
+		fprintf(fp, "    { \"attributes\": { \"POSITION\": 0, \"NORMAL\": 1 }, \"mode\": 4 },\n");
+	fprintf(fp, "    { \"attributes\": { \"POSITION\": %d, \"NORMAL\": %d }, \"mode\": 3 }\n",
+			line, line + 1);
+	fprintf(fp, "  ] } ],\n");
+	fprintf(fp, "  \"buffers\": [ { \"uri\": \"%s\", \"byteLength\": %lu } ],\n",
+			binName, (unsigned long)length);
+	fprintf(fp, "  \"bufferViews\": [ { \"buffer\": 0, \"byteLength\": %lu, "
+				"\"byteStride\": %lu, \"target\": 34962 } ],\n",
+			(unsigned long)length, (unsigned long)stride);
+	fprintf(fp, "  \"accessors\": [\n");
+	if (nVerts) {
+		gltfAccessor(fp, 0, nVerts, lo, hi, false);
+		gltfAccessor(fp, 12, nVerts, 0, 0, false);
+	}
+	gltfAccessor(fp, nVerts * stride, nLine, llo, lhi, false);
+	gltfAccessor(fp, nVerts * stride + 12, nLine, 0, 0, true);
+	fprintf(fp, "  ]\n}\n");
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+exportTrack(const TrackCurve& curve, const TrackMesh& mesh, const char* filename,
+			std::string& why, Progress* progress)
+//============================================================================
+{
+	std::string name = filename;
+	size_t dot = name.rfind('.');
+	std::string ext = (dot == std::string::npos) ? "" : name.substr(dot);
+	for (size_t i = 0; i < ext.size(); ++i)
+		ext[i] = (char)tolower(ext[i]);
+
+	Format format;
+	if (ext == ".obj")
+		format = Obj;
+	else if (ext == ".ply")
+		format = Ply;
+	else if (ext == ".gltf")
+		format = Gltf;
+	else {
+		why = "Export to a .obj, .ply or .gltf file";
+		return false;
+	}
+	if (curve.chunks.empty()) {
+		why = "There is no track to export";
+		return false;
+	}
+
+	// the .gltf's data goes in the .bin, which is what is streamed
+	std::string binName;
+	if (format == Gltf) {
+		binName = name.substr(0, dot) + ".bin";
+		name = binName;
+	}
+
+	SafeFile file;
+	if (!file.open(name.c_str())) {
+		why = "Can't open file for writing";
+		return false;
+	}
+	FILE* fp = file.file();
+	if (format == Obj)
+		fprintf(fp, "# a roller coaster track\no rails_and_ties\n");
+	else if (format == Ply)
+		plyHeader(fp, 0, 0, 0);
+
+	Exporter exporter(curve, mesh, format);
+	if (!exporter.run(fp, why, progress))
+		return false;
+
+	bool ok = writeCenterLine(fp, curve, format);
+	size_t nLine = curve.size();
+	if (ok && format == Ply) {
+		ok = plyIndices(fp, exporter.nVerts, nLine);
+		fseek(fp, 0, SEEK_SET);
+		plyHeader(fp, exporter.nVerts + nLine, exporter.nVerts / 3, nLine ? nLine - 1 : 0);
+		fseek(fp, 0, SEEK_END);
+	}
+	if (!ok || !file.commit()) {
+		why = "Couldn't write all of the file (it is just as it was)";
+		return false;
+	}
+
+	if (format == Gltf) {
+		SafeFile gltf;
+		if (!gltf.open(filename)) {
+			why = "Can't open file for writing";
+			return false;
+		}
+		size_t slash = binName.find_last_of("/\\");
+		std::string uri = (slash == std::string::npos) ? binName : binName.substr(slash + 1);
+		gltfFile(gltf.file(), uri.c_str(), exporter.nVerts, exporter.lo, exporter.hi, curve);
+		if (!gltf.commit()) {
+			why = "Couldn't write all of the file (it is just as it was)";
+			return false;
+		}
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+reportExport(const char* track, const char* filename, int splineType, int samplesPerSegment)
+//============================================================================
+{
+	CTrack t;
+	if (!t.readPoints(track, false))
+		return false;
+
+	double t0 = SimClock::now();
+	TrackCurve curve;
+	curve.build(t.points, splineType, samplesPerSegment);
+	TrackMesh mesh;
+	double buildTime = SimClock::now() - t0;
+
+	std::string why;
+	t0 = SimClock::now();
+	if (!exportTrack(curve, mesh, filename, why)) {
+		printf("%s: %s\n", filename, why.c_str());
+		return false;
+	}
+	double exportTime = SimClock::now() - t0;
+
+	// the .gltf itself is small - the .bin is what was streamed
+	std::string written = filename;
+	size_t dot = written.rfind('.');
+	if (dot != std::string::npos && written.substr(dot) == ".gltf")
+		written = written.substr(0, dot) + ".bin";
+	FILE* fp = fopen(written.c_str(), "rb");
+	long size = 0;
+	if (fp) {
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fclose(fp);
+	}
+	printf("%s: %lu samples in %lu chunks (%.0f ms)\n", track, (unsigned long)curve.size(),
+		   (unsigned long)curve.chunks.size(), buildTime * 1000);
+	printf("%s: %.1f MB in %.0f ms, %.0f MB/s\n", written.c_str(), size / 1048576.0,
+		   exportTime * 1000, size / 1048576.0 / exportTime);
+	return true;
+}
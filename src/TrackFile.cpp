@@ -0,0 +1,253 @@
+/************************************************************************
+     File:        TrackFile.cpp
+
+     Comment:     Control points in a binary file, read with no parsing
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "TrackFile.H"
+#include "MappedFile.H"
+#include "SafeFile.H"
+#include "Track.H"
+#include "SimClock.H"
+
+static const char	magic[4] = { 'T', 'R', 'K', 'B' };
+
+// what each byte does to a CRC - entry[k][b] is byte b followed by k zeros,
+// so four bytes can be done at once
+struct CrcTable {
+	CrcTable()
+	{
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			entry[0][i] = c;
+		}
+		for (int k = 1; k < 4; ++k)
+			for (int i = 0; i < 256; ++i)
+				entry[k][i] = entry[0][entry[k - 1][i] & 0xff] ^ (entry[k - 1][i] >> 8);
+	}
+	uint32_t	entry[4][256];
+};
+
+//****************************************************************************
+//
+// * four bytes at a time, then what is left one at a time
+//============================================================================
+uint32_t
+crcOf(const void* data, size_t n, uint32_t crc)
+//============================================================================
+{
+	static const CrcTable table;
+	const uint32_t (*t)[256] = table.entry;
+	const unsigned char* p = (const unsigned char*)data;
+	crc = ~crc;
+	for (; n >= 4; n -= 4, p += 4) {
+		crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		crc = t[3][crc & 0xff] ^ t[2][(crc >> 8) & 0xff] ^
+			  t[1][(crc >> 16) & 0xff] ^ t[0][crc >> 24];
+	}
+	for (; n; --n)
+		crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+isTrackFile(const char* filename)
+//============================================================================
+{
+	FILE* fp = fopen(filename, "rb");
+	if (!fp)
+		return false;
+	char start[sizeof(magic)];
+	bool is = fread(start, 1, sizeof(start), fp) == sizeof(start) &&
+			  !memcmp(start, magic, sizeof(magic));
+	fclose(fp);
+	return is;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+const char*
+readTrackFile(const char* filename, std::vector<ControlPoint>& points)
+//============================================================================
+{
+	MappedFile file;
+	if (!file.open(filename))
+		return "Can't Open File!";
+
+	TrackFileHeader h;
+	if (file.size() < sizeof(h))
+		return "Not a track file";
+	memcpy(&h, file.data(), sizeof(h));
+	if (memcmp(h.magic, magic, sizeof(magic)))
+		return "Not a track file";
+	if (h.version > TrackFileHeader::Version)
+		return "The track file is from a newer version";
+	if (h.count < 4)
+		return "Illegal Number of Points Specified in File";
+
+	// both arrays have to be in the file, and lined up for floats
+	unsigned long long bytes = (unsigned long long)h.count * 3 * sizeof(float);
+	if ((h.positions | h.orients) & 3 ||
+		h.positions + bytes > file.size() || h.orients + bytes > file.size())
+		return "The track file is cut short";
+
+	const float* pos = (const float*)(file.data() + h.positions);
+	const float* orient = (const float*)(file.data() + h.orients);
+	if (h.flags & TrackFileHeader::HasChecksum) {
+		uint32_t c = crcOf(pos, (size_t)bytes);
+		if (crcOf(orient, (size_t)bytes, c) != h.checksum)
+			return "The track file is damaged (the checksum is wrong)";
+	}
+
+	std::vector<ControlPoint> loaded(h.count);
+	for (size_t i = 0; i < h.count; ++i) {
+		loaded[i].pos = Pnt3f(pos + 3 * i);
+		loaded[i].orient = Pnt3f(orient + 3 * i);
+	}
+	points.swap(loaded);
+	return 0;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+const char*
+writeTrackFile(const char* filename, const std::vector<ControlPoint>& points, bool checksum)
+//============================================================================
+{
+	size_t n = points.size();
+	if (n > 0x0fffffff)
+		return "Too many points for a track file";
+
+	std::vector<float> pos(3 * n + 1), orient(3 * n + 1);
+	for (size_t i = 0; i < n; ++i) {
+		memcpy(&pos[3 * i], &points[i].pos.x, 3 * sizeof(float));
+		memcpy(&orient[3 * i], &points[i].orient.x, 3 * sizeof(float));
+	}
+	size_t bytes = 3 * n * sizeof(float);
+
+	TrackFileHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = TrackFileHeader::Version;
+	h.count = (uint32_t)n;
+	h.positions = sizeof(h);
+	h.orients = (uint32_t)((sizeof(h) + bytes + 15) & ~(size_t)15);
+	if (checksum) {
+		h.flags |= TrackFileHeader::HasChecksum;
+		h.checksum = crcOf(&orient[0], bytes, crcOf(&pos[0], bytes));
+	}
+
+	SafeFile file;
+	if (!file.open(filename))
+		return "Can't open file for writing";
+	FILE* fp = file.file();
+	static const char zeros[16] = { 0 };
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(&pos[0], 1, bytes, fp);
+	fwrite(zeros, 1, h.orients - sizeof(h) - bytes, fp);
+	fwrite(&orient[0], 1, bytes, fp);
+	if (!file.commit())
+		return "Couldn't write all of the track file (it is just as it was)";
+	return 0;
+}
+
+//****************************************************************************
+//
+// * the best of a few goes, in ms
+//============================================================================
+template <class F>
+static double best(F load)
+//============================================================================
+{
+	double t = 1e30;
+	for (int i = 0; i < 5; ++i) {
+		double t0 = SimClock::now();
+		load();
+		double took = SimClock::now() - t0;
+		if (took < t) t = took;
+	}
+	return t * 1000;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void
+reportTrackFiles(size_t n)
+//============================================================================
+{
+	// a long wiggly loop, with every number a different one
+	CTrack track;
+	track.points.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		float a = 6.2831853f * i / n;
+		track.points[i].pos = Pnt3f(300 * cosf(a), 40 + 30 * sinf(17 * a), 300 * sinf(a));
+		Pnt3f o(.2f * sinf(5 * a), 1, .2f * cosf(3 * a));
+		o.normalize();
+		track.points[i].orient = o;
+	}
+
+	const char* text = "trackfiles-bench.txt";
+	const char* binary = "trackfiles-bench.trk";
+	const char* plain = "trackfiles-bench-nocrc.trk";
+	bool wrote = true;
+	double textWrite = best([&]() { wrote = track.writePoints(text, false) && wrote; });
+	double binaryWrite = best([&]() { wrote = !writeTrackFile(binary, track.points) && wrote; });
+	wrote = !writeTrackFile(plain, track.points, false) && wrote;
+	if (!wrote) {
+		printf("Can't write the test files\n");
+		return;
+	}
+
+	CTrack fromText;
+	std::vector<ControlPoint> fromBinary, fromPlain;
+	double textTime = best([&]() { fromText.readPoints(text, false); });
+	double binaryTime = best([&]() { readTrackFile(binary, fromBinary); });
+	double plainTime = best([&]() { readTrackFile(plain, fromPlain); });
+
+	// the binary ones are the very same floats, and so should the text be
+	// (to_chars writes enough digits)
+	bool same = fromBinary.size() == n && fromPlain.size() == n;
+	float textError = fromText.points.size() == n ? 0 : 1e30f;
+	for (size_t i = 0; i < n && same; ++i) {
+		same = !memcmp(&fromBinary[i].pos.x, &track.points[i].pos.x, 3 * sizeof(float)) &&
+			   !memcmp(&fromBinary[i].orient.x, &track.points[i].orient.x, 3 * sizeof(float)) &&
+			   !memcmp(&fromPlain[i].pos.x, &track.points[i].pos.x, 3 * sizeof(float));
+		if (textError < 1e30f) {
+			Pnt3f d = fromText.points[i].pos - track.points[i].pos;
+			textError = fmaxf(textError, fmaxf(fabsf(d.x), fmaxf(fabsf(d.y), fabsf(d.z))));
+		}
+	}
+
+	printf("%lu points\n", (unsigned long)n);
+	printf("  saving text:            %8.3f ms\n", textWrite);
+	printf("  saving binary:          %8.3f ms\n", binaryWrite);
+	printf("  loading text:           %8.3f ms (off by up to %g)\n", textTime, textError);
+	printf("  loading binary:         %8.3f ms - %.0f times faster\n",
+		   binaryTime, textTime / binaryTime);
+	printf("  ... with no checksum:   %8.3f ms - %.0f times faster\n",
+		   plainTime, textTime / plainTime);
+	printf("  the binary points are %s\n", same ? "exactly the same" : "DIFFERENT");
+
+	remove(text);
+	remove(binary);
+	remove(plain);
+}
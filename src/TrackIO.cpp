@@ -0,0 +1,217 @@
+/************************************************************************
+     File:        TrackIO.cpp
+
+     Comment:     Loading and saving tracks off the user interface thread
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <string.h>
+
+#include "TrackIO.H"
+#include "TrackFile.H"
+#include "TrackImport.H"
+#include "TrackText.H"
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+TrackIO::
+TrackIO()
+	: notify(0), notifyData(0), job(None), running(false), result(None)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+TrackIO::
+~TrackIO()
+//============================================================================
+{
+	cancel();
+	if (thread.joinable())
+		thread.join();
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackIO::
+setNotify(void (*n)(void*), void* data)
+//============================================================================
+{
+	notify = n;
+	notifyData = data;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool TrackIO::
+load(const char* name)
+//============================================================================
+{
+	return start(Load, name);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool TrackIO::
+reload(const char* name)
+//============================================================================
+{
+	return start(Reload, name);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool TrackIO::
+save(const char* name, const std::vector<ControlPoint>& pts)
+//============================================================================
+{
+	if (busy())
+		return false;
+	points = pts;
+	return start(Save, name);
+}
+
+//****************************************************************************
+//
+// * the last job's thread is done with (it's not busy), so it only has
+//   to be joined
+//============================================================================
+bool TrackIO::
+start(Job j, const char* name)
+//============================================================================
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running)
+		return false;
+	if (thread.joinable())
+		thread.join();
+
+	job = j;
+	filename = name;
+	result = None;
+	why.clear();
+	status.done = 0;
+	status.cancel = false;
+	running = true;
+	thread = std::thread(&TrackIO::work, this);
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackIO::
+cancel()
+//============================================================================
+{
+	status.cancel = true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool TrackIO::
+busy() const
+//============================================================================
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return running;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+TrackIO::Job TrackIO::
+finished(std::vector<ControlPoint>& pts, std::string& whyNot)
+//============================================================================
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Job done = result;
+	if (done != None) {
+		pts.swap(points);
+		points.clear();
+		whyNot = why;
+		result = None;
+	}
+	return done;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+std::string TrackIO::
+name() const
+//============================================================================
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return filename;
+}
+
+//****************************************************************************
+//
+// * on the job's thread
+//============================================================================
+void TrackIO::
+work()
+//============================================================================
+{
+	std::vector<ControlPoint> pts;
+	std::string whyNot;
+	const char* name = filename.c_str();
+	size_t len = filename.size();
+	if (job == Load || job == Reload) {
+		if (len > 4 && !strcmp(name + len - 4, ".csv"))
+			importSurvey(name, pts, whyNot, ImportOptions(), 0, &status);
+		else if (isTrackFile(name)) {
+			const char* w = readTrackFile(name, pts);
+			if (w)
+				whyNot = w;
+		}
+		else
+			readTrackText(name, pts, whyNot, &status);
+	}
+	else {
+		if (len > 4 && !strcmp(name + len - 4, ".trk")) {
+			const char* w = writeTrackFile(name, points);
+			if (w)
+				whyNot = w;
+		}
+		else
+			writeTrackText(name, points, whyNot, &status);
+		pts.swap(points);		// they go back with the result
+	}
+	status.done = 1;
+	if (status.cancelled()) {
+		pts.clear();
+		whyNot.clear();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		points.swap(pts);
+		why = whyNot;
+		result = job;
+		running = false;
+	}
+	if (notify)
+		notify(notifyData);
+}
@@ -0,0 +1,505 @@
+/************************************************************************
+     File:        TrackImport.cpp
+
+     Comment:     Making a track out of a surveyed centerline
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <charconv>
+
+#include "TrackImport.H"
+#include "TrackCurve.H"
+#include "TrackText.H"
+#include "SimClock.H"
+#include "WorkPool.H"
+
+// bytes read from the file at a time, and per piece of work in that
+static const size_t blockBytes = 8 * 1024 * 1024;
+static const size_t pieceBytes = 256 * 1024;
+
+// control points the fit starts with
+static const size_t firstPoints = 8;
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+ImportOptions::
+ImportOptions()
+	: autoOrigin(true), scale(1), rotate(0), tolerance(.5f), maxPoints(2000),
+	  maxSamples(200000)
+//============================================================================
+{
+	for (int k = 0; k < 3; ++k) {
+		columns[k] = k;
+		origin[k] = 0;
+	}
+}
+
+// one line-aligned piece of a block, and the rows in it (east, north, up)
+struct CsvPiece {
+	const char*				begin;
+	const char*				end;
+	std::vector<double>		rows;
+	size_t					lines;			// that it starts
+	bool					failed;			// (then it stopped there)
+	size_t					errorLine;		// in the piece, from 0
+	std::string				error;
+};
+
+static inline float norm(const Pnt3f& a)
+{
+	return sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
+}
+
+static inline bool space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '"';
+}
+
+static inline bool separator(char c)
+{
+	return c == ',' || c == ';';
+}
+
+//****************************************************************************
+//
+// * every line from begin to end, stopping at the first bad one. only the
+//   fields in columns are read; the rest are skipped over
+//============================================================================
+static void
+parsePiece(CsvPiece& c, const int* columns, int lastColumn)
+//============================================================================
+{
+	c.rows.clear();
+	c.lines = 0;
+	c.failed = false;
+	c.error.clear();
+
+	const char* p = c.begin;
+	while (p < c.end) {
+		const char* eol = (const char*)memchr(p, '\n', c.end - p);
+		if (!eol)
+			eol = c.end;
+
+		double v[3];
+		int found = 0;
+		bool blank = true;
+		const char* q = p;
+		for (int field = 0; field <= lastColumn && c.error.empty(); ++field) {
+			const char* f = q;
+			while (q < eol && !separator(*q))
+				++q;
+			const char* e = q;
+			while (f < e && space(*f))
+				++f;
+			while (e > f && space(e[-1]))
+				--e;
+			if (e > f)
+				blank = false;
+
+			for (int k = 0; k < 3; ++k) {
+				if (columns[k] != field)
+					continue;
+				const char* s = (f < e && *f == '+') ? f + 1 : f;
+				std::from_chars_result r = std::from_chars(s, e, v[k]);
+				if (f == e || r.ec != std::errc() || r.ptr != e)
+					c.error = "\"" + std::string(f, std::min(e, f + 24)) + "\" isn't a number";
+				else
+					++found;
+			}
+			if (q == eol) {
+				if (field < lastColumn && !blank)
+					c.error = "there aren't enough columns";
+				break;
+			}
+			++q;
+		}
+
+		// a line with nothing on it is fine
+		if (!c.error.empty() && !(blank && q == eol)) {
+			c.failed = true;
+			c.errorLine = c.lines;
+			return;
+		}
+		c.error.clear();
+		if (found == 3)
+			c.rows.insert(c.rows.end(), v, v + 3);
+		++c.lines;
+		p = eol + 1;
+	}
+}
+
+//****************************************************************************
+//
+// * the survey, as few points as the fit needs: nothing closer than spacing
+//   to the last one, and never more than most of them
+//============================================================================
+struct Thinner {
+	Thinner(size_t m) : most(m < 8 ? 8 : m), spacing(0) { kept.reserve(most + 1); }
+
+	void add(const Pnt3f& p)
+	{
+		if (!kept.empty()) {
+			Pnt3f d = p - kept.back();
+			if (d.x * d.x + d.y * d.y + d.z * d.z <= spacing * spacing)
+				return;
+		}
+		kept.push_back(p);
+		if (kept.size() <= most)
+			return;
+
+		// too many - every other one goes, and they come half as often
+		size_t n = 0;
+		for (size_t i = 0; i < kept.size(); i += 2)
+			kept[n++] = kept[i];
+		kept.resize(n);
+		float length = 0;
+		for (size_t i = 1; i < n; ++i)
+			length += norm(kept[i] - kept[i - 1]);
+		spacing = std::max(spacing * 2, length / (n - 1));
+	}
+
+	size_t				most;
+	float				spacing;
+	std::vector<Pnt3f>	kept;
+};
+
+//****************************************************************************
+//
+// * survey coordinates to track ones
+//============================================================================
+struct SurveyTransform {
+	SurveyTransform(const ImportOptions& o)
+		: options(o), haveOrigin(!o.autoOrigin)
+	{
+		for (int k = 0; k < 3; ++k)
+			origin[k] = o.origin[k];
+		double a = o.rotate * 3.14159265358979 / 180;
+		co = cos(a) * o.scale;
+		si = sin(a) * o.scale;
+	}
+
+	Pnt3f operator()(const double* row)
+	{
+		if (!haveOrigin) {
+			for (int k = 0; k < 3; ++k)
+				origin[k] = row[k];
+			haveOrigin = true;
+		}
+		double east = row[0] - origin[0];
+		double north = row[1] - origin[1];
+		double up = row[2] - origin[2];
+		return Pnt3f((float)(co * east + si * north), (float)(up * options.scale),
+					 (float)(si * east - co * north));
+	}
+
+	const ImportOptions&	options;
+	bool					haveOrigin;
+	double					origin[3];
+	double					co, si;
+};
+
+//****************************************************************************
+//
+// * read the file a block at a time, parse the blocks in parallel, and thin
+//   the rows in order
+//============================================================================
+static bool
+readSurvey(const char* filename, const ImportOptions& options, Thinner& thin, size_t& rows,
+		   WorkPool& pool, std::string& why, Progress* progress)
+//============================================================================
+{
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) {
+		why = "Can't Open File!";
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	double size = (double)ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	int lastColumn = std::max(options.columns[0], std::max(options.columns[1], options.columns[2]));
+	SurveyTransform transform(options);
+	std::vector<char> block(blockBytes);
+	std::vector<CsvPiece> pieces;
+	size_t carry = 0;			// the start of a line, left from the last block
+	size_t line = 1;			// of the block's first line
+	double bytesRead = 0;
+	rows = 0;
+	bool ok = true;
+	for (bool last = false; ok && !last; ) {
+		size_t n = fread(&block[carry], 1, block.size() - carry, fp);
+		bytesRead += n;
+		last = n < block.size() - carry;
+		size_t used = carry + n;
+		if (!used)
+			break;
+
+		// the block stops at the end of its last whole line
+		size_t cut = used;
+		if (!last) {
+			while (cut > 0 && block[cut - 1] != '\n')
+				--cut;
+			if (!cut) {
+				char number[32];
+				snprintf(number, sizeof(number), "%lu", (unsigned long)line);
+				why = std::string("line ") + number + ": it is far too long";
+				ok = false;
+				break;
+			}
+		}
+
+		// cut it into pieces, each starting at a line
+		const char* begin = &block[0];
+		const char* end = begin + cut;
+		size_t count = 0;
+		for (const char* p = begin; p < end; ++count) {
+			const char* e = p + pieceBytes < end ? p + pieceBytes : end;
+			while (e < end && e[-1] != '\n')
+				++e;
+			if (count == pieces.size())
+				pieces.push_back(CsvPiece());
+			pieces[count].begin = p;
+			pieces[count].end = e;
+			p = e;
+		}
+		pool.parallelFor(count, 1, [&](size_t b, size_t e) {
+			for (size_t i = b; i < e; ++i)
+				parsePiece(pieces[i], options.columns, lastColumn);
+		});
+
+		for (size_t i = 0; i < count; ++i) {
+			const CsvPiece& c = pieces[i];
+			const double* r = c.rows.empty() ? 0 : &c.rows[0];
+			size_t m = c.rows.size() / 3;
+
+			// the column names, if the file starts with them
+			bool names = c.failed && line == 1 && c.errorLine == 0;
+			if (c.failed && !names) {
+				char number[32];
+				snprintf(number, sizeof(number), "%lu", (unsigned long)(line + c.errorLine));
+				why = std::string("line ") + number + ": " + c.error;
+				ok = false;
+				break;
+			}
+			for (size_t j = 0; j < m; ++j)
+				thin.add(transform(r + 3 * j));
+			rows += m;
+			line += c.lines;
+			if (names) {
+				// the rest of the piece, after the names
+				CsvPiece rest;
+				rest.begin = (const char*)memchr(c.begin, '\n', c.end - c.begin);
+				rest.begin = rest.begin ? rest.begin + 1 : c.end;
+				rest.end = c.end;
+				parsePiece(rest, options.columns, lastColumn);
+				if (rest.failed) {
+					char number[32];
+					snprintf(number, sizeof(number), "%lu", (unsigned long)(2 + rest.errorLine));
+					why = std::string("line ") + number + ": " + rest.error;
+					ok = false;
+					break;
+				}
+				for (size_t j = 0; j < rest.rows.size() / 3; ++j)
+					thin.add(transform(&rest.rows[3 * j]));
+				rows += rest.rows.size() / 3;
+				line += 1 + rest.lines;
+			}
+		}
+
+		carry = used - cut;
+		memmove(&block[0], &block[cut], carry);
+		if (progress) {
+			progress->done = (float)(.8 * bytesRead / (size > 0 ? size : 1));
+			if (progress->cancelled()) {
+				why = "Cancelled";
+				ok = false;
+			}
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+//****************************************************************************
+//
+// * how far segment k is from the samples it should go through, and the
+//   sample halfway along it
+//============================================================================
+static float
+segmentError(const std::vector<Pnt3f>& samples, const std::vector<float>& arc,
+			 const std::vector<size_t>& at, const std::vector<ControlPoint>& points,
+			 size_t k, size_t& middle)
+//============================================================================
+{
+	size_t a = at[k];
+	size_t b = (k + 1 < at.size()) ? at[k + 1] : samples.size();
+	float length = arc[b] - arc[a];
+	float error = 0;
+	middle = a;
+	for (size_t j = a + 1; j < b; ++j) {
+		float t = length > 0 ? (arc[j] - arc[a]) / length : 0;
+		Pnt3f p, d, o;
+		TrackCurve::evaluate(points, TrackCurve::Cardinal, (float)k + t, p, d, o);
+		float e = norm(p - samples[j]);
+		if (e > error)
+			error = e;
+		if (arc[j] - arc[a] <= length / 2)
+			middle = j;
+	}
+	return error;
+}
+
+//****************************************************************************
+//
+// * control points at some of the samples - the segments that are off are
+//   split in two. (splitting where they are furthest off makes uneven
+//   segments, and a Cardinal spline overshoots on those)
+//============================================================================
+static float
+fitLoop(const std::vector<Pnt3f>& samples, const ImportOptions& options, WorkPool& pool,
+		std::vector<ControlPoint>& points, Progress* progress)
+//============================================================================
+{
+	// the distance along the loop to each sample (and back to the first)
+	size_t n = samples.size();
+	std::vector<float> arc(n + 1);
+	arc[0] = 0;
+	for (size_t i = 1; i <= n; ++i)
+		arc[i] = arc[i - 1] + norm(samples[i % n] - samples[i - 1]);
+
+	// start evenly spread
+	size_t most = std::max<size_t>(4, std::min(options.maxPoints, n));
+	std::vector<size_t> at;
+	size_t start = std::min(firstPoints, most);
+	for (size_t k = 0, i = 0; k < start; ++k) {
+		float s = arc[n] * k / start;
+		while (i + 1 < n && arc[i] < s)
+			++i;
+		if (at.empty() || i > at.back())
+			at.push_back(i);
+	}
+
+	std::vector<float> errors;
+	std::vector<size_t> middle;
+	std::vector<std::pair<float, size_t> > bad;
+	float error = 0;
+	for (;;) {
+		points.resize(at.size());
+		for (size_t k = 0; k < at.size(); ++k)
+			points[k] = ControlPoint(samples[at[k]]);
+
+		size_t m = at.size();
+		errors.resize(m);
+		middle.resize(m);
+		pool.parallelFor(m, 16, [&](size_t b, size_t e) {
+			for (size_t k = b; k < e; ++k)
+				errors[k] = segmentError(samples, arc, at, points, k, middle[k]);
+		});
+
+		bad.clear();
+		error = 0;
+		for (size_t k = 0; k < m; ++k) {
+			error = std::max(error, errors[k]);
+			if (errors[k] > options.tolerance && middle[k] != at[k])
+				bad.push_back(std::make_pair(errors[k], k));
+		}
+		if (bad.empty() || m >= most || (progress && progress->cancelled()))
+			break;
+
+		// the worst ones first, as many as there is room for
+		if (bad.size() > most - m) {
+			std::nth_element(bad.begin(), bad.begin() + (most - m), bad.end(),
+							 [](const std::pair<float, size_t>& x, const std::pair<float, size_t>& y) {
+								 return x.first > y.first;
+							 });
+			bad.resize(most - m);
+		}
+		for (size_t i = 0; i < bad.size(); ++i)
+			at.push_back(middle[bad[i].second]);
+		std::sort(at.begin(), at.end());
+		if (progress)
+			progress->done = .8f + .2f * (float)at.size() / (float)most;
+	}
+	return error;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+importSurvey(const char* filename, std::vector<ControlPoint>& points, std::string& why,
+			 const ImportOptions& options, ImportStats* stats, Progress* progress)
+//============================================================================
+{
+	WorkPool pool;
+	Thinner thin(options.maxSamples);
+	size_t rows = 0;
+	if (!readSurvey(filename, options, thin, rows, pool, why, progress))
+		return false;
+
+	// a loop that comes back to where it started doesn't need its end
+	std::vector<Pnt3f>& samples = thin.kept;
+	while (samples.size() > 1) {
+		Pnt3f d = samples.back() - samples[0];
+		if (d.x * d.x + d.y * d.y + d.z * d.z > thin.spacing * thin.spacing)
+			break;
+		samples.pop_back();
+	}
+	if (samples.size() < 4) {
+		why = "there aren't 4 different points in it";
+		return false;
+	}
+
+	std::vector<ControlPoint> fitted;
+	float error = fitLoop(samples, options, pool, fitted, progress);
+	if (progress && progress->cancelled()) {
+		why = "Cancelled";
+		return false;
+	}
+	if (stats) {
+		stats->rows = rows;
+		stats->samples = samples.size();
+		stats->error = error;
+	}
+	points.swap(fitted);
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+reportImport(const char* csvFile, const char* trackFile, const ImportOptions& options)
+//============================================================================
+{
+	std::vector<ControlPoint> points;
+	std::string why;
+	ImportStats stats;
+	double t0 = SimClock::now();
+	if (!importSurvey(csvFile, points, why, options, &stats)) {
+		printf("%s: %s\n", csvFile, why.c_str());
+		return false;
+	}
+	double importTime = SimClock::now() - t0;
+	if (!writeTrackText(trackFile, points, why)) {
+		printf("%s: %s\n", trackFile, why.c_str());
+		return false;
+	}
+
+	printf("%s: %lu rows, %lu kept for the fit (%.0f ms)\n", csvFile,
+		   (unsigned long)stats.rows, (unsigned long)stats.samples, importTime * 1000);
+	printf("%s: %lu control points, at most %g from the survey%s\n", trackFile,
+		   (unsigned long)points.size(), stats.error,
+		   stats.error > options.tolerance ? " (more than the tolerance - allow more points)" : "");
+	return true;
+}
@@ -0,0 +1,266 @@
+/************************************************************************
+     File:        TrackMesh.cpp
+
+     Comment:     Drawable geometry for the track, at several levels of detail
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+
+#include <windows.h>
+#include <GL/gl.h>
+
+#include "TrackMesh.H"
+
+//****************************************************************************
+//
+// * little helpers for filling in the vertex arrays
+//============================================================================
+static inline float dot(const Pnt3f& a, const Pnt3f& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline void vert(std::vector<float>& v, const Pnt3f& p, const Pnt3f& n)
+{
+	v.push_back(p.x);	v.push_back(p.y);	v.push_back(p.z);
+	v.push_back(n.x);	v.push_back(n.y);	v.push_back(n.z);
+}
+
+// a quad as two triangles. p0,p1 are at one end (with normal n0), p2,p3 at
+// the other (with n1). the corners get turned around if needed so that the
+// front faces the way the normals point
+static void quad(std::vector<float>& v,
+				 const Pnt3f& p0, const Pnt3f& p1, const Pnt3f& n0,
+				 const Pnt3f& p2, const Pnt3f& p3, const Pnt3f& n1)
+{
+	Pnt3f f = (p1 - p0) * (p2 - p0);
+	if (dot(f, n0 + n1) >= 0) {
+		vert(v, p0, n0);	vert(v, p1, n0);	vert(v, p2, n1);
+		vert(v, p0, n0);	vert(v, p2, n1);	vert(v, p3, n1);
+	} else {
+		vert(v, p0, n0);	vert(v, p2, n1);	vert(v, p1, n0);
+		vert(v, p0, n0);	vert(v, p3, n1);	vert(v, p2, n1);
+	}
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+TrackMesh::
+TrackMesh()
+	: gauge(4), railSize(.5f), tieSpacing(3),
+	  maxStepPixels(4), hysteresis(.25f), serial(0)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackMesh::
+reset(const TrackCurve& curve)
+//============================================================================
+{
+	serial = curve.serial;
+
+	size_t n = curve.chunks.size();
+	pieces.clear();
+	pieces.resize(n * nLevels);
+	for (size_t i = 0; i < pieces.size(); ++i)
+		pieces[i].built = false;
+
+	// start coarse - pickLevel refines right away if it needs to
+	levels.assign(n, (unsigned char)(nLevels - 1));
+
+	counts.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		counts[i] = curve.chunks[i].count;
+}
+
+//****************************************************************************
+//
+// * how long is a step between samples at level l, on the screen?
+//   go finer while it is too long, coarser while the next level would
+//   still be short enough. the hysteresis keeps a gap between the two
+//============================================================================
+int TrackMesh::
+pickLevel(int chunk, float pixelSize)
+//============================================================================
+{
+	float steps = (float)counts[chunk];
+	float finer = maxStepPixels * (1 + hysteresis);
+	float coarser = maxStepPixels * (1 - hysteresis);
+
+	int l = levels[chunk];
+	while (l > 0 && pixelSize * (1 << l) / steps > finer)
+		--l;
+	while (l < nLevels - 1 && pixelSize * (1 << (l + 1)) / steps < coarser)
+		++l;
+
+	levels[chunk] = (unsigned char)l;
+	return l;
+}
+
+//****************************************************************************
+//
+// * make the geometry for one chunk at one level, and keep it
+//============================================================================
+void TrackMesh::
+build(const TrackCurve& curve, int chunk, int level, Piece& piece)
+//============================================================================
+{
+	geometry(curve, chunk, level, piece.verts, piece.railVerts, piece.railPrim);
+	piece.tieVerts = (int)(piece.verts.size() / 6) - piece.railVerts;
+	piece.built = true;
+}
+
+//****************************************************************************
+//
+// * make the geometry for one chunk at one level
+//============================================================================
+void TrackMesh::
+geometry(const TrackCurve& curve, int chunk, int level,
+		 std::vector<float>& v, int& railVerts, int& railPrim) const
+//============================================================================
+{
+	const TrackCurve::Chunk& c = curve.chunks[chunk];
+	int stride = 1 << level;
+
+	// the samples this level uses - always including the last one, so
+	// the chunk still meets the next one
+	std::vector<int> idx;
+	for (int k = 0; k < c.count; k += stride)
+		idx.push_back(c.first + k);
+	idx.push_back(c.first + c.count);
+
+	v.clear();
+
+	float half = gauge / 2;
+	float w = railSize / 2;
+	float h = railSize;
+
+	//*********************************************************************
+	// the rails
+	//*********************************************************************
+	for (size_t k = 0; k + 1 < idx.size(); ++k) {
+		int a = idx[k];
+		int b = idx[k + 1];
+		const Pnt3f& ua = curve.up[a];
+		const Pnt3f& ub = curve.up[b];
+		Pnt3f sa = curve.tangent[a] * ua;	// sideways (to the right)
+		Pnt3f sb = curve.tangent[b] * ub;
+
+		if (level == 3) {
+			// just the center line
+			Pnt3f pa = curve.pos[a] + ua * h;
+			Pnt3f pb = curve.pos[b] + ub * h;
+			vert(v, pa, ua);
+			vert(v, pb, ub);
+			continue;
+		}
+
+		for (int side = -1; side <= 1; side += 2) {
+			Pnt3f ca = curve.pos[a] + sa * (side * half);
+			Pnt3f cb = curve.pos[b] + sb * (side * half);
+
+			if (level == 2) {
+				vert(v, ca + ua * h, ua);
+				vert(v, cb + ub * h, ub);
+				continue;
+			}
+
+			// the corners of the cross-section, going around it
+			Pnt3f ra[4] = { ca - sa * w + ua * h, ca + sa * w + ua * h,
+							ca + sa * w,          ca - sa * w };
+			Pnt3f rb[4] = { cb - sb * w + ub * h, cb + sb * w + ub * h,
+							cb + sb * w,          cb - sb * w };
+			Pnt3f na[4] = { ua, sa, ua * -1, sa * -1 };
+			Pnt3f nb[4] = { ub, sb, ub * -1, sb * -1 };
+
+			// level 1 only has the top
+			int faces = (level == 0) ? 4 : 1;
+			for (int f = 0; f < faces; ++f) {
+				int g = (f + 1) % 4;
+				quad(v, ra[f], ra[g], na[f], rb[g], rb[f], nb[f]);
+			}
+		}
+	}
+	railPrim = (level >= 2) ? GL_LINES : GL_TRIANGLES;
+	railVerts = (int)(v.size() / 6);
+
+	//*********************************************************************
+	// the ties - one every tieSpacing along the track (every other one on
+	// level 1). a tie belongs to the chunk where the spacing is crossed
+	//*********************************************************************
+	if (level <= 1) {
+		float hl = half + 1;		// half the length of a tie
+		float hw = .5f;				// half its width
+		float th = .3f;				// and its height
+		for (int j = c.first; j < c.first + c.count; ++j) {
+			int t0 = (int)floorf(curve.arc[j] / tieSpacing);
+			int t1 = (int)floorf(curve.arc[j + 1] / tieSpacing);
+			if (t0 == t1 || (level == 1 && (t1 & 1)))
+				continue;
+
+			const Pnt3f& p = curve.pos[j + 1];
+			const Pnt3f& t = curve.tangent[j + 1];
+			const Pnt3f& u = curve.up[j + 1];
+			Pnt3f s = t * u;
+
+			Pnt3f tl = p - s * hl - t * hw;
+			Pnt3f tr = p + s * hl - t * hw;
+			Pnt3f br = p + s * hl + t * hw;
+			Pnt3f bl = p - s * hl + t * hw;
+			quad(v, tl, tr, u, br, bl, u);
+			if (level == 0) {
+				Pnt3f d = u * -th;
+				quad(v, tl, tr, t * -1, tr + d, tl + d, t * -1);
+				quad(v, bl, br, t, br + d, bl + d, t);
+			}
+		}
+	}
+}
+
+//****************************************************************************
+//
+// * draw a chunk - rails, then the ties
+//============================================================================
+int TrackMesh::
+draw(const TrackCurve& curve, int chunk, int level, bool doingShadows)
+//============================================================================
+{
+	Piece& p = pieces[chunk * nLevels + level];
+	if (!p.built)
+		build(curve, chunk, level, p);
+	if (p.verts.empty())
+		return 0;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), &p.verts[0]);
+	glNormalPointer(GL_FLOAT, 6 * sizeof(float), &p.verts[3]);
+
+	if (!doingShadows)
+		glColor3ub(32, 32, 64);
+	if (p.railPrim == GL_LINES)
+		glLineWidth(2);
+	glDrawArrays(p.railPrim, 0, p.railVerts);
+	if (p.railPrim == GL_LINES)
+		glLineWidth(1);
+
+	if (p.tieVerts) {
+		if (!doingShadows)
+			glColor3ub(120, 80, 40);
+		glDrawArrays(GL_TRIANGLES, p.railVerts, p.tieVerts);
+	}
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	return p.railVerts + p.tieVerts;
+}
@@ -0,0 +1,413 @@
+/************************************************************************
+     File:        TrackNetwork.cpp
+
+     Comment:     Tracks joined up by switches
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "TrackNetwork.H"
+#include "SimClock.H"
+
+static inline float norm(const Pnt3f& a)
+{
+	return sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+TrackNetwork::
+TrackNetwork()
+	: type(TrackCurve::Cardinal)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+int TrackNetwork::
+addNode(const Pnt3f& pos, const Pnt3f& dir, const Pnt3f& orient)
+//============================================================================
+{
+	Node n;
+	n.pos = pos;
+	n.dir = dir;
+	n.dir.normalize();
+	n.orient = orient;
+	n.outSetting = n.inSetting = 0;
+	nodes.push_back(n);
+	return (int)nodes.size() - 1;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+int TrackNetwork::
+addEdge(int from, int to, const std::vector<ControlPoint>& points)
+//============================================================================
+{
+	Edge e;
+	e.from = from;
+	e.to = to;
+	e.points = points;
+	e.closed = false;
+	e.dirty = true;
+	edges.push_back(e);
+
+	int i = (int)edges.size() - 1;
+	nodes[from].out.push_back(i);
+	nodes[to].in.push_back(i);
+	next.push_back(-1);
+	prev.push_back(-1);
+	route(from);
+	route(to);
+	return i;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackNetwork::
+moveNode(int node, const Pnt3f& pos, const Pnt3f& dir)
+//============================================================================
+{
+	Node& n = nodes[node];
+	n.pos = pos;
+	n.dir = dir;
+	n.dir.normalize();
+	for (size_t i = 0; i < n.in.size(); ++i)
+		edges[n.in[i]].dirty = true;
+	for (size_t i = 0; i < n.out.size(); ++i)
+		edges[n.out[i]].dirty = true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackNetwork::
+setPoints(int edge, const std::vector<ControlPoint>& points)
+//============================================================================
+{
+	edges[edge].points = points;
+	edges[edge].dirty = true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackNetwork::
+setSwitch(int node, int outSetting)
+//============================================================================
+{
+	Node& n = nodes[node];
+	if (outSetting >= 0 && outSetting < (int)n.out.size()) {
+		n.outSetting = outSetting;
+		route(node);
+	}
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackNetwork::
+setTrailing(int node, int inSetting)
+//============================================================================
+{
+	Node& n = nodes[node];
+	if (inSetting >= 0 && inSetting < (int)n.in.size()) {
+		n.inSetting = inSetting;
+		route(node);
+	}
+}
+
+//****************************************************************************
+//
+// * fill in the tables for the edges that go through the node
+//============================================================================
+void TrackNetwork::
+route(int node)
+//============================================================================
+{
+	const Node& n = nodes[node];
+	int out = n.out.empty() ? -1 : n.out[n.outSetting];
+	int in = n.in.empty() ? -1 : n.in[n.inSetting];
+	for (size_t i = 0; i < n.in.size(); ++i)
+		next[n.in[i]] = out;
+	for (size_t i = 0; i < n.out.size(); ++i)
+		prev[n.out[i]] = in;
+}
+
+//****************************************************************************
+//
+// * the Cardinal tangent at a point is half of the way from the point
+//   before it to the point after it. so the steering point at each end is
+//   put so that that is the node's direction, as long as the chord to the
+//   next point
+//============================================================================
+void TrackNetwork::
+splinePoints(int e, std::vector<ControlPoint>& points) const
+//============================================================================
+{
+	const Edge& edge = edges[e];
+	const Node& a = nodes[edge.from];
+	const Node& b = nodes[edge.to];
+
+	if (edge.closed) {
+		points = edge.points;
+		return;
+	}
+
+	const Pnt3f& first = edge.points.empty() ? b.pos : edge.points.front().pos;
+	const Pnt3f& last = edge.points.empty() ? a.pos : edge.points.back().pos;
+	float chordA = norm(first - a.pos);
+	float chordB = norm(b.pos - last);
+
+	points.clear();
+	points.push_back(ControlPoint(first - a.dir * (2 * chordA), a.orient));
+	points.push_back(ControlPoint(a.pos, a.orient));
+	points.insert(points.end(), edge.points.begin(), edge.points.end());
+	points.push_back(ControlPoint(b.pos, b.orient));
+	points.push_back(ControlPoint(last + b.dir * (2 * chordB), b.orient));
+}
+
+//****************************************************************************
+//
+// * an edge's curve is never changed - a new one is made, so a copy of the
+//   network that has the old one still has it
+//============================================================================
+void TrackNetwork::
+update(int _type, int samplesPerSegment)
+//============================================================================
+{
+	type = _type;
+
+	std::vector<ControlPoint> points;
+	for (size_t i = 0; i < edges.size(); ++i) {
+		Edge& e = edges[i];
+		if (!e.dirty && e.curve && e.curve->type == type &&
+			e.curve->samplesPerSegment == samplesPerSegment)
+			continue;
+		splinePoints((int)i, points);
+		std::shared_ptr<TrackCurve> c = std::make_shared<TrackCurve>();
+		c->build(points, type, samplesPerSegment, 50, e.closed);
+		e.curve = c;
+		e.dirty = false;
+	}
+}
+
+//****************************************************************************
+//
+// * the node is where the loop is at u = 0, pointing the way it goes - as
+//   the curve has it, if it is there to ask (a B-spline doesn't go through
+//   the first point)
+//============================================================================
+void TrackNetwork::
+makeLoop(const std::vector<ControlPoint>& points,
+		 const std::shared_ptr<const TrackCurve>& curve)
+//============================================================================
+{
+	if (points.size() < 2)
+		return;
+
+	size_t n = points.size();
+	Pnt3f pos = points[0].pos, dir = points[1].pos - points[n - 1].pos;
+	Pnt3f orient = points[0].orient;
+	if (curve && curve->size()) {
+		pos = curve->pos[0];
+		dir = curve->tangent[0];
+		orient = curve->up[0];
+	}
+
+	if (edges.empty() || !edges[0].closed) {
+		nodes.clear();
+		edges.clear();
+		next.clear();
+		prev.clear();
+		int node = addNode(pos, dir, orient);
+		addEdge(node, node, points);
+		edges[0].closed = true;
+	}
+	else {
+		const Node& node = nodes[0];
+		Pnt3f unit = dir;
+		unit.normalize();
+		if (norm(node.pos - pos) != 0 || norm(node.dir - unit) != 0 ||
+			norm(node.orient - orient) != 0) {
+			moveNode(0, pos, dir);
+			nodes[0].orient = orient;
+		}
+		edges[0].points = points;
+	}
+
+	edges[0].curve = curve;
+	edges[0].dirty = !curve;
+}
+
+//****************************************************************************
+//
+// * a train can cross more than one (short) edge in a step, but never
+//   more than all of them
+//============================================================================
+bool TrackNetwork::
+move(Place& p, float ds) const
+//============================================================================
+{
+	p.s += ds;
+	for (size_t tries = 0; tries <= edges.size(); ++tries) {
+		float len = length(p.edge);
+		if (p.s > len) {
+			int e = next[p.edge];
+			if (e < 0) {
+				p.s = len;
+				return false;
+			}
+			p.s -= len;
+			p.edge = e;
+		}
+		else if (p.s < 0) {
+			int e = prev[p.edge];
+			if (e < 0) {
+				p.s = 0;
+				return false;
+			}
+			p.edge = e;
+			p.s += length(e);
+		}
+		else
+			return true;
+	}
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void TrackNetwork::
+frames(const Place* places, size_t n, Pnt3f* pos, Pnt3f* tangent, Pnt3f* up) const
+//============================================================================
+{
+	if (!n)
+		return;
+
+	std::vector<int> order(n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = (int)i;
+	std::sort(order.begin(), order.end(),
+			  [places](int a, int b) { return places[a].edge < places[b].edge; });
+
+	std::vector<float> s;
+	std::vector<Pnt3f> p, t, u;
+	for (size_t first = 0; first < n; ) {
+		int e = places[order[first]].edge;
+		size_t last = first;
+		while (last < n && places[order[last]].edge == e)
+			++last;
+
+		size_t m = last - first;
+		s.resize(m);
+		p.resize(m);
+		t.resize(m);
+		u.resize(m);
+		for (size_t j = 0; j < m; ++j)
+			s[j] = places[order[first + j]].s;
+		edges[e].curve->frames(&s[0], m, &p[0], &t[0], &u[0]);
+		for (size_t j = 0; j < m; ++j) {
+			int i = order[first + j];
+			pos[i] = p[j];
+			tangent[i] = t[j];
+			up[i] = u[j];
+		}
+		first = last;
+	}
+}
+
+//****************************************************************************
+//
+// * the default track, with a wider bypass alongside the first half. the
+//   switch at the start of it is thrown every time the first train comes
+//   round. checks that the rails meet up at the nodes, then times the
+//   trains going round
+//============================================================================
+void
+reportNetwork(size_t trains, double seconds)
+//============================================================================
+{
+	TrackNetwork net;
+	int a = net.addNode(Pnt3f(50, 5, 0), Pnt3f(0, 0, 1));
+	int b = net.addNode(Pnt3f(-50, 5, 0), Pnt3f(0, 0, -1));
+	std::vector<ControlPoint> pts;
+	pts.push_back(ControlPoint(Pnt3f(0, 5, 50)));
+	net.addEdge(a, b, pts);
+	pts.clear();
+	pts.push_back(ControlPoint(Pnt3f(25, 5, 75)));
+	pts.push_back(ControlPoint(Pnt3f(-25, 5, 75)));
+	int bypass = net.addEdge(a, b, pts);
+	pts.clear();
+	pts.push_back(ControlPoint(Pnt3f(0, 5, -50)));
+	int back = net.addEdge(b, a, pts);
+	net.update();
+
+	// how far apart the two ends are, and the angle between them, where
+	// every edge meets every edge it can lead to
+	float gap = 0, angle = 0;
+	for (size_t e = 0; e < net.edges.size(); ++e) {
+		const TrackNetwork::Node& n = net.nodes[net.edges[e].to];
+		for (size_t k = 0; k < n.out.size(); ++k) {
+			TrackNetwork::Place ends[2] = {
+				TrackNetwork::Place((int)e, net.length((int)e)),
+				TrackNetwork::Place(n.out[k], 0)
+			};
+			Pnt3f p[2], t[2], u[2];
+			net.frames(ends, 2, p, t, u);
+			float g = norm(p[1] - p[0]);
+			float d = t[0].x * t[1].x + t[0].y * t[1].y + t[0].z * t[1].z;
+			float w = acosf(d > 1 ? 1 : d) * 180 / 3.14159265f;
+			if (g > gap) gap = g;
+			if (w > angle) angle = w;
+		}
+	}
+	printf("edges %lu, lengths", (unsigned long)net.edges.size());
+	for (size_t e = 0; e < net.edges.size(); ++e)
+		printf(" %.1f", net.length((int)e));
+	printf("\nworst joint: %.4f apart, %.3f degrees\n", gap, angle);
+
+	// spread out along the way back, going 20 a second
+	std::vector<TrackNetwork::Place> places(trains);
+	for (size_t i = 0; i < trains; ++i)
+		places[i] = TrackNetwork::Place(back, net.length(back) * i / trains);
+
+	const float dt = .01f, speed = 20;
+	size_t ticks = (size_t)(seconds / dt);
+	unsigned long onBypass = 0, laps = 0;
+	double start = SimClock::now();
+	for (size_t i = 0; i < ticks; ++i) {
+		int was = places[0].edge;
+		for (size_t j = 0; j < trains; ++j)
+			net.move(places[j], speed * dt);
+		if (was == back && places[0].edge != back) {
+			++laps;
+			net.setSwitch(a, net.nodes[a].outSetting ? 0 : 1);
+		}
+		for (size_t j = 0; j < trains; ++j)
+			onBypass += places[j].edge == bypass;
+	}
+	double time = SimClock::now() - start;
+	printf("%lu trains, %lu laps of the first one, %.0f%% of the time on the bypass\n",
+		   (unsigned long)trains, laps, 100.0 * onBypass / ((double)ticks * trains));
+	printf("%.1f ns per train-step\n", time * 1e9 / ((double)ticks * trains));
+}
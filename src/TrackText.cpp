@@ -0,0 +1,265 @@
+/************************************************************************
+     File:        TrackText.cpp
+
+     Comment:     Reading and writing the text track files, fast
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <charconv>
+
+#include "TrackText.H"
+#include "MappedFile.H"
+#include "SafeFile.H"
+#include "WorkPool.H"
+
+// bytes of the file per piece of work
+static const size_t chunkBytes = 256 * 1024;
+
+// bytes written out at a time, and the most one line can take
+static const size_t blockBytes = 1024 * 1024;
+static const size_t lineBytes = 6 * 32;
+
+// one line-aligned piece of the file, and what came out of it
+struct TextChunk {
+	const char*					begin;
+	const char*					end;
+	std::vector<ControlPoint>	points;
+	size_t						lines;			// that it starts
+	bool						failed;			// (then it stopped there)
+	size_t						errorLine;		// in the chunk, from 0
+	std::string					error;
+};
+
+static inline bool space(char c)
+{
+	return (unsigned char)c <= ' ';
+}
+
+//****************************************************************************
+//
+// * what a word that isn't a number was, for the error
+//============================================================================
+static std::string
+word(const char* p, const char* end)
+//============================================================================
+{
+	const char* e = p;
+	while (e < end && !space(*e) && e - p < 24)
+		++e;
+	return std::string(p, e);
+}
+
+//****************************************************************************
+//
+// * every line from begin to end, stopping at the first bad one
+//============================================================================
+static void
+parseChunk(TextChunk& c)
+//============================================================================
+{
+	c.points.reserve((c.end - c.begin) / 24 + 1);
+	c.lines = 0;
+	c.failed = false;
+
+	const char* p = c.begin;
+	while (p < c.end) {
+		const char* eol = (const char*)memchr(p, '\n', c.end - p);
+		if (!eol)
+			eol = c.end;
+
+		float v[6];
+		int n = 0;
+		const char* q = p;
+		for (;;) {
+			while (q < eol && space(*q))
+				++q;
+			if (q == eol || *q == '#')
+				break;
+			if (n == 6) {
+				c.error = "there are more than 6 numbers";
+				break;
+			}
+
+			// from_chars won't take a + (strtod did)
+			const char* s = (*q == '+') ? q + 1 : q;
+			std::from_chars_result r = std::from_chars(s, eol, v[n]);
+			if (r.ec != std::errc() || (r.ptr < eol && !space(*r.ptr) && *r.ptr != '#')) {
+				c.error = "\"" + word(q, eol) + "\" isn't a number";
+				break;
+			}
+			++n;
+			q = r.ptr;
+		}
+		if (c.error.empty() && n != 0 && n != 3 && n != 6)
+			c.error = "there should be 3 or 6 numbers";
+		if (!c.error.empty()) {
+			c.failed = true;
+			c.errorLine = c.lines;
+			return;
+		}
+
+		if (n) {
+			Pnt3f orient = (n == 6) ? Pnt3f(v[3], v[4], v[5]) : Pnt3f(0, 1, 0);
+			orient.normalize();
+			c.points.push_back(ControlPoint(Pnt3f(v[0], v[1], v[2]), orient));
+		}
+		++c.lines;
+		p = eol + 1;
+	}
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+readTrackText(const char* filename, std::vector<ControlPoint>& points, std::string& why,
+			  Progress* progress)
+//============================================================================
+{
+	MappedFile file;
+	if (!file.open(filename)) {
+		why = "Can't Open File!";
+		return false;
+	}
+	const char* begin = (const char*)file.data();
+	const char* end = begin + file.size();
+
+	// first line = number of points
+	const char* p = begin;
+	while (p < end && *p != '\n' && space(*p))
+		++p;
+	unsigned long long count = 0;
+	std::from_chars_result r = std::from_chars(p, end, count);
+	if (r.ec != std::errc() || count < 4) {
+		why = "line 1: Illegal Number of Points Specified in File";
+		return false;
+	}
+	const char* body = (const char*)memchr(r.ptr, '\n', end - r.ptr);
+	body = body ? body + 1 : end;
+
+	// cut the rest at the first line break after every chunkBytes
+	std::vector<TextChunk> chunks;
+	while (body < end) {
+		TextChunk c;
+		c.begin = body;
+		if (end - body <= (ptrdiff_t)(chunkBytes + chunkBytes / 2))
+			body = end;
+		else {
+			const char* cut = (const char*)memchr(body + chunkBytes, '\n',
+												  end - (body + chunkBytes));
+			body = cut ? cut + 1 : end;
+		}
+		c.end = body;
+		chunks.push_back(c);
+	}
+
+	std::atomic<size_t> parsed(0);
+	size_t total = end - begin;
+	WorkPool pool;
+	pool.parallelFor(chunks.size(), 1, [&](size_t b, size_t e) {
+		for (size_t i = b; i < e; ++i) {
+			if (progress && progress->cancelled())
+				return;
+			parseChunk(chunks[i]);
+			if (progress) {
+				size_t n = parsed += chunks[i].end - chunks[i].begin;
+				progress->done = (float)n / total;
+			}
+		}
+	});
+	if (progress && progress->cancelled()) {
+		why = "Cancelled";
+		return false;
+	}
+
+	// end to end, up to the count (anything after that is ignored, as it
+	// always was - even if it's wrong)
+	std::vector<ControlPoint> loaded;
+	loaded.reserve((size_t)count < file.size() ? (size_t)count : file.size());
+	size_t line = 2;
+	for (size_t i = 0; i < chunks.size() && loaded.size() < count; ++i) {
+		const TextChunk& c = chunks[i];
+		size_t need = (size_t)count - loaded.size();
+		if (c.failed && c.points.size() < need) {
+			char where[32];
+			sprintf(where, "line %lu: ", (unsigned long)(line + c.errorLine));
+			why = where + c.error;
+			return false;
+		}
+		size_t take = (c.points.size() < need) ? c.points.size() : need;
+		loaded.insert(loaded.end(), c.points.begin(), c.points.begin() + take);
+		line += c.lines;
+	}
+	if (loaded.size() < count) {
+		char what[96];
+		sprintf(what, "the file ends after %lu of its %llu points",
+				(unsigned long)loaded.size(), count);
+		why = what;
+		return false;
+	}
+
+	points.swap(loaded);
+	return true;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+bool
+writeTrackText(const char* filename, const std::vector<ControlPoint>& points, std::string& why,
+			   Progress* progress)
+//============================================================================
+{
+	SafeFile file;
+	if (!file.open(filename)) {
+		why = "Can't open file for writing";
+		return false;
+	}
+	FILE* fp = file.file();
+	setvbuf(fp, 0, _IONBF, 0);		// the blocks are big enough already
+
+	std::vector<char> buffer(blockBytes + lineBytes);
+	char* start = &buffer[0];
+	char* p = start;
+	char* full = start + blockBytes;
+	bool ok = true;
+
+	p = std::to_chars(p, full, (unsigned long long)points.size()).ptr;
+	*p++ = '\n';
+	for (size_t i = 0; i < points.size() && ok; ++i) {
+		const float v[6] = {
+			points[i].pos.x, points[i].pos.y, points[i].pos.z,
+			points[i].orient.x, points[i].orient.y, points[i].orient.z
+		};
+		for (int k = 0; k < 6; ++k) {
+			p = std::to_chars(p, p + 32, v[k]).ptr;
+			*p++ = (k < 5) ? ' ' : '\n';
+		}
+		if (p >= full) {
+			ok = fwrite(start, 1, p - start, fp) == (size_t)(p - start);
+			p = start;
+			if (progress) {
+				progress->done = (float)(i + 1) / points.size();
+				if (progress->cancelled()) {
+					why = "Cancelled";
+					return false;
+				}
+			}
+		}
+	}
+	if (ok && p > start)
+		ok = fwrite(start, 1, p - start, fp) == (size_t)(p - start);
+
+	if (!ok || !file.commit()) {
+		why = "Couldn't write all of the file (it is just as it was)";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,188 @@
+/************************************************************************
+     File:        TrainPhysics.cpp
+
+     Comment:     Trains that coast - gravity, friction, drag, chain lifts
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include <math.h>
+
+#include "TrainPhysics.H"
+
+const float TrainPhysics::noCap = 1e30f;
+
+//****************************************************************************
+//
+// * Constructor - the track is a few hundred units around, so this is
+//   roughly "feet"
+//============================================================================
+TrainPhysics::Params::
+Params()
+	: gravity(32), friction(.015f), drag(.0004f), liftSpeed(10)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+TrainPhysics::
+TrainPhysics()
+	: wrap(true), length(0), serial(0), samplesPerSegment(1)
+//============================================================================
+{
+}
+
+//****************************************************************************
+//
+// * sample i is at parameter i / samplesPerSegment, so a lift covers the
+//   samples from its start to its end
+//============================================================================
+void TrainPhysics::
+prepare(const TrackCurve& curve)
+//============================================================================
+{
+	serial = curve.serial;
+	samplesPerSegment = curve.samplesPerSegment > 0 ? curve.samplesPerSegment : 1;
+	length = curve.length;
+
+	size_t n = curve.size();
+	arc = curve.arc;
+	grade.resize(n);
+	normal.resize(n);
+	lift.assign(n, 0);
+	for (size_t i = 0; i < n; ++i) {
+		grade[i] = curve.tangent[i].y;
+		normal[i] = fabsf(curve.up[i].y);
+	}
+
+	float segments = (float)curve.nSegments;
+	for (size_t j = 0; j < lifts.size(); ++j) {
+		float from = lifts[j].from, to = lifts[j].to;
+		if (segments <= 0 || from == to)
+			continue;
+		from = fmodf(from, segments);
+		if (from < 0) from += segments;
+		to = fmodf(to, segments);
+		if (to < 0) to += segments;
+
+		for (size_t i = 0; i < n; ++i) {
+			float u = (float)i / samplesPerSegment;
+			if ((from < to) ? (u >= from && u < to) : (u >= from || u < to))
+				lift[i] = 1;
+		}
+	}
+}
+
+//****************************************************************************
+//
+// * s goes around the loop (or stops at the ends), and the hint walks
+//   along with it - a train only gets a few samples further each step
+//============================================================================
+float TrainPhysics::
+locate(float s, int& k) const
+//============================================================================
+{
+	int last = (int)arc.size() - 2;		// the last sample a step starts at
+	if (last < 0 || length <= 0) {
+		k = 0;
+		return 0;
+	}
+
+	if (wrap) {
+		s = fmodf(s, length);
+		if (s < 0) s += length;
+	}
+	else if (s < 0)
+		s = 0;
+	else if (s > length)
+		s = length;
+
+	if (k < 0 || k > last) k = 0;
+	while (k < last && arc[k + 1] <= s)
+		++k;
+	while (k > 0 && arc[k] > s)
+		--k;
+	return s;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+float TrainPhysics::
+arcAt(float u, int& k) const
+//============================================================================
+{
+	int last = (int)arc.size() - 2;
+	if (last < 0)
+		return 0;
+
+	float x = u * samplesPerSegment;
+	k = (int)floorf(x);
+	if (k < 0) k = 0;
+	if (k > last) k = last;
+	float f = x - k;
+	return arc[k] + f * (arc[k + 1] - arc[k]);
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+float TrainPhysics::
+paramAt(float s, int& k) const
+//============================================================================
+{
+	s = locate(s, k);
+	if (arc.size() < 2)
+		return 0;
+
+	float d = arc[k + 1] - arc[k];
+	float f = (d > 0) ? (s - arc[k]) / d : 0;
+	return (k + f) / samplesPerSegment;
+}
+
+//****************************************************************************
+//
+// * one symplectic Euler step for each train. the slope and the normal are
+//   blended between the samples on either side, so the force doesn't jump
+//============================================================================
+void TrainPhysics::
+step(float dt, size_t n, float* s, float* v, int* hint, const float* cap) const
+//============================================================================
+{
+	if (arc.size() < 2)
+		return;
+
+	const Params& p = params;
+	for (size_t i = 0; i < n; ++i) {
+		int k = hint[i];
+		float si = locate(s[i], k);
+		float d = arc[k + 1] - arc[k];
+		float f = (d > 0) ? (si - arc[k]) / d : 0;
+		float g = grade[k] + f * (grade[k + 1] - grade[k]);
+		float up = normal[k] + f * (normal[k + 1] - normal[k]);
+
+		// gravity, then the forces that only ever slow it down
+		float vi = v[i] - p.gravity * g * dt;
+		float slow = (p.friction * p.gravity * up + p.drag * vi * vi) * dt;
+		if (fabsf(vi) <= slow)
+			vi = 0;
+		else
+			vi -= (vi > 0) ? slow : -slow;
+
+		if (lift[k] && vi < p.liftSpeed)
+			vi = p.liftSpeed;
+
+		if (cap && cap[i] < noCap)
+			vi = (vi > cap[i]) ? cap[i] : ((vi < 0) ? 0 : vi);
+
+		s[i] = wrap ? locate(si + vi * dt, k) : si + vi * dt;
+		v[i] = vi;
+		hint[i] = k;
+	}
+}
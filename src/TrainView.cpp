@@ -25,6 +25,7 @@
 *************************************************************************/
 
 #include <iostream>
+#include <string.h>
 #include <Fl/fl.h>
 
 // we will need OpenGL, and OpenGL needs windows.h
@@ -38,15 +39,11 @@
 #include "TrainWindow.H"
 #include "Utilities/3DUtils.H"
 
-#include "Matrices.h"
-
 
 #ifdef EXAMPLE_SOLUTION
 #	include "TrainExample/TrainExample.H"
 #endif
 
-#define DIVIDE_LINE 100
-
 //************************************************************************
 //
 // * Constructor to set up the GL window
@@ -58,6 +55,12 @@ TrainView(int x, int y, int w, int h, const char* l)
 {
 	mode(FL_RGB | FL_ALPHA | FL_DOUBLE | FL_STENCIL);
 
+	frameTime = 0;
+	carLength = 8;
+	carGap = 2;
+	cullStats.reset();
+	latency.reset();
+
 	resetArcball();
 }
 
@@ -118,8 +121,10 @@ int TrainView::handle(int event)
 	case FL_DRAG:
 
 		// Compute the new control point position
-		if ((last_push == FL_LEFT_MOUSE) && (selectedCube >= 0)) {
-			ControlPoint* cp = &m_pTrack->points[selectedCube];
+		// (the point moves when the simulation gets around to it)
+		if ((last_push == FL_LEFT_MOUSE) && (selectedCube >= 0) &&
+			selectedCube < (int)world().points->size()) {
+			const ControlPoint* cp = &(*world().points)[selectedCube];
 
 			double r1x, r1y, r1z, r2x, r2y, r2z;
 			getMouseLine(r1x, r1y, r1z, r2x, r2y, r2z);
@@ -132,10 +137,9 @@ int TrainView::handle(int event)
 				rx, ry, rz,
 				(Fl::event_state() & FL_CTRL) != 0);
 
-			cp->pos.x = (float)rx;
-			cp->pos.y = (float)ry;
-			cp->pos.z = (float)rz;
-			damage(1);
+			Simulation::Command c(Simulation::Command::MovePoint, selectedCube);
+			c.where = Pnt3f((float)rx, (float)ry, (float)rz);
+			tw->simulation.post(c);
 		}
 		break;
 
@@ -151,22 +155,39 @@ int TrainView::handle(int event)
 	case FL_KEYBOARD:
 		int k = Fl::event_key();
 		int ks = Fl::event_state();
+		const std::vector<ControlPoint>& points = *world().points;
 		if (k == 'p') {
 			// Print out the selected control point information
-			if (selectedCube >= 0)
+			if (selectedCube >= 0 && selectedCube < (int)points.size())
 				printf("Selected(%d) (%g %g %g) (%g %g %g)\n",
 					selectedCube,
-					m_pTrack->points[selectedCube].pos.x,
-					m_pTrack->points[selectedCube].pos.y,
-					m_pTrack->points[selectedCube].pos.z,
-					m_pTrack->points[selectedCube].orient.x,
-					m_pTrack->points[selectedCube].orient.y,
-					m_pTrack->points[selectedCube].orient.z);
+					points[selectedCube].pos.x,
+					points[selectedCube].pos.y,
+					points[selectedCube].pos.z,
+					points[selectedCube].orient.x,
+					points[selectedCube].orient.y,
+					points[selectedCube].orient.z);
 			else
 				printf("Nothing Selected\n");
 
 			return 1;
 		};
+		if (k == 'v') {
+			// check the GPU splines against the CPU ones (-gpucheck does
+			// this too, with no window)
+			make_current();
+			gpuSpline.update(points, world().trackVersion);
+			const char* names[3] = { "Linear", "Cardinal", "B-Spline" };
+			for (int type = TrackCurve::Linear; type <= TrackCurve::BSpline; ++type) {
+				float rails = 0;
+				float err = gpuSpline.validate(points, type, 16, &rails);
+				if (err < 0)
+					printf("GPU %s: can't check (needs OpenGL 4.0)\n", names[type - 1]);
+				else
+					printf("GPU %s: largest error %g, rails %g\n", names[type - 1], err, rails);
+			}
+			return 1;
+		}
 		break;
 	}
 
@@ -180,19 +201,25 @@ int TrainView::handle(int event)
 //========================================================================
 void TrainView::draw()
 {
+	// draw the newest state of the world, as of now
+	tw->simulation.fetch();
+	frameTime = SimClock::now();
 
 	//*********************************************************************
 	//
 	// * Set up basic opengl informaiton
 	//
 	//**********************************************************************
-	//initialized glad
-	if (gladLoadGL())
-	{
-		//initiailize VAO, VBO, Shader...
+	// initialize glad, and everything that lives in the GL context, once
+	// per context (FlTk tells us when the context is new)
+	if (!context_valid()) {
+		if (!gladLoadGL())
+			throw std::runtime_error("Could not initialize GLAD!");
+
+		groundPlane.init();
+		shadowMap.init();
+		gpuSpline.init();
 	}
-	else
-		throw std::runtime_error("Could not initialize GLAD!");
 
 	// Set up the view port
 	glViewport(0, 0, w(), h());
@@ -260,32 +287,160 @@ void TrainView::draw()
 
 
 
+	//*********************************************************************
+	// bring the shadow map up to date (no shadows in the top view). this
+	// only redraws the map when something that casts a shadow has changed
+	//*********************************************************************
+	bool doShadows = !tw->topCam->value() && shadowMap.valid();
+	if (doShadows) {
+		updateShadowMap(lightPosition1);
+		glViewport(0, 0, w(), h());
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		setProjection();
+	}
+
+	// remember what the camera can see, so drawStuff can skip the rest
+	frustum.extract();
+
 	//*********************************************************************
 	// now draw the ground plane
 	//*********************************************************************
 	// set to opengl fixed pipeline(use opengl 1.x draw function)
 	glUseProgram(0);
 
-	setupFloor();
+	glEnable(GL_DEPTH_TEST);
 	glDisable(GL_LIGHTING);
-	drawFloor(200, 10);
-
+	shadowMap.bind(groundPlane.shader, doShadows);
+	groundPlane.draw(200, 10);
 
 	//*********************************************************************
-	// now draw the object and we need to do it twice
-	// once for real, and then once for shadows
+	// now draw the objects - just once, the shadows come out of the map
 	//*********************************************************************
 	glEnable(GL_LIGHTING);
-	setupObjects();
+	if (shadowMap.valid()) {
+		shadowMap.bind(shadowMap.objectShader, doShadows);
+		shadowMap.objectShader.use();
+	}
 
 	drawStuff();
 
-	// this time drawing is for shadows (except for top view)
-	if (!tw->topCam->value()) {
-		setupShadows();
-		drawStuff(true);
-		unsetupShadows();
+	shadowMap.unbind();
+
+	// how long did the newest command take to get here?
+	const WorldSnapshot& state = world();
+	if (state.inputTime > latency.seen) {
+		latency.seen = state.inputTime;
+		latency.last = SimClock::now() - state.inputTime;
+		latency.count++;
+		latency.average += (latency.last - latency.average) /
+						   (latency.count < 30 ? latency.count : 30);
+		if (latency.last > latency.worst) latency.worst = latency.last;
+	}
+
+	// tell the user how much got culled
+	char buf[256];
+	if (cullStats.gpuPatches)
+		sprintf(buf, "Track: %d patches on the GPU\n"
+					 "%lu bytes sent last edit\n"
+					 "Objects: %d drawn, %d culled",
+				cullStats.gpuPatches, gpuSpline.bytesSent,
+				cullStats.objectsDrawn, cullStats.objectsCulled);
+	else
+		sprintf(buf, "Track: %d drawn, %d culled\n"
+					 "LOD %d/%d/%d/%d, %d verts\n"
+					 "Objects: %d drawn, %d culled",
+				cullStats.chunksDrawn, cullStats.chunksCulled,
+				cullStats.chunksAtLevel[0], cullStats.chunksAtLevel[1],
+				cullStats.chunksAtLevel[2], cullStats.chunksAtLevel[3],
+				cullStats.trackVertices,
+				cullStats.objectsDrawn, cullStats.objectsCulled);
+	sprintf(buf + strlen(buf), "\nInput to frame: %.1f ms (worst %.1f)",
+			latency.average * 1000, latency.worst * 1000);
+	if (state.planned)
+		sprintf(buf + strlen(buf), "\nPlan: %.1f s a lap, %.2f ms to plan",
+				state.lapTime, state.planTime * 1000);
+	if (state.network && state.network->edges.size() > 1) {
+		const TrackNetwork::Node& node = state.network->nodes[0];
+		sprintf(buf + strlen(buf), "\nSwitch: way %d of %d, train on edge %d",
+				node.outSetting + 1, (int)node.out.size(), state.trainEdge);
 	}
+	// the Rec button says what was asked for - this says if it is going
+	if (state.recording)
+		sprintf(buf + strlen(buf), "\nRecording: step %lu", state.ticks);
+	tw->cullInfo->copy_label(buf);
+}
+
+//************************************************************************
+//
+// *
+//========================================================================
+const WorldSnapshot& TrainView::
+world() const
+//========================================================================
+{
+	return tw->simulation.snapshot();
+}
+
+//************************************************************************
+//
+// * Draw the casters into the shadow map - but only if the map is out of
+//   date. Everything drawStuff draws depends on the points, the spline,
+//   the train and the camera (the train camera hides some things)
+//========================================================================
+void TrainView::
+updateShadowMap(const float lightDir[3])
+//========================================================================
+{
+	ShadowMap::Key key;
+	key.trackVersion = world().trackVersion;
+	TrackNetwork::Place train = world().trainPlace(frameTime);
+	key.networkVersion = world().networkVersion;
+	key.trainEdge = train.edge;
+	key.trainS = train.s;
+	key.cars = (int)tw->cars->value();
+	key.splineType = world().splineType;
+	key.gpuTrack = tw->gpuTrack->value() && gpuSpline.valid();
+	key.camera = tw->worldCam->value() ? 0 : (tw->trainCam->value() ? 1 : 2);
+	key.resolution = shadowMap.resolution;
+	key.light[0] = lightDir[0];
+	key.light[1] = lightDir[1];
+	key.light[2] = lightDir[2];
+
+	if (!shadowMap.stale(key))
+		return;
+
+	// a box around everything that casts a shadow. the track stays close
+	// to the control points (the branches' too), and the train is never
+	// far from the track
+	std::vector<Pnt3f> corners;
+	const std::vector<ControlPoint>& points = *world().points;
+	for (size_t i = 0; i < points.size(); ++i)
+		corners.push_back(points[i].pos);
+	if (world().network) {
+		const TrackNetwork& network = *world().network;
+		for (size_t e = 1; e < network.edges.size(); ++e)
+			for (size_t i = 0; i < network.edges[e].points.size(); ++i)
+				corners.push_back(network.edges[e].points[i].pos);
+	}
+	Pnt3f lo = corners[0];
+	Pnt3f hi = lo;
+	for (size_t i = 1; i < corners.size(); ++i) {
+		const Pnt3f& p = corners[i];
+		if (p.x < lo.x) lo.x = p.x;
+		if (p.y < lo.y) lo.y = p.y;
+		if (p.z < lo.z) lo.z = p.z;
+		if (p.x > hi.x) hi.x = p.x;
+		if (p.y > hi.y) hi.y = p.y;
+		if (p.z > hi.z) hi.z = p.z;
+	}
+	Pnt3f margin(10, 10, 10);
+	lo = lo - margin;
+	hi = hi + margin;
+
+	shadowMap.begin(key, lightDir, lo, hi);
+	drawStuff(true);
+	shadowMap.end();
 }
 
 //************************************************************************
@@ -333,18 +488,12 @@ setProjection()
 	else {
 		
 
-		int p1 = m_pTrack->trainU / 1;
-		int p2 = (p1 + 1) % m_pTrack->points.size();
-
-		float t = m_pTrack->trainU - p1;
-
-		Pnt3f qt = (1 - t) * m_pTrack->points[p1].pos + t * m_pTrack->points[p2].pos;
-
-		Pnt3f foward = m_pTrack->points[p2].pos - m_pTrack->points[p1].pos;
-
-		Pnt3f cp_orient_p1 = m_pTrack->points[p1].orient;
-		Pnt3f cp_orient_p2 = m_pTrack->points[p2].orient;
-		Pnt3f orient_t = (1 - t) * cp_orient_p1 + t * cp_orient_p2;
+		// sitting at the front of the train, on whichever edge it is on
+		Pnt3f qt(0, 0, 0), foward(1, 0, 0), orient_t(0, 1, 0);
+		TrackNetwork::Place train = world().trainPlace(frameTime);
+		if (world().network && train.edge < (int)world().network->edges.size())
+			world().network->frames(&train, 1, &qt, &foward, &orient_t);
+		foward = foward * 10;
 		
 		
 		glMatrixMode(GL_PROJECTION);
@@ -376,18 +525,35 @@ setProjection()
 //========================================================================
 void TrainView::drawStuff(bool doingShadows)
 {
+	// only the real pass is culled against the camera - the shadow map
+	// needs the casters that are off screen too
+	bool cull = !doingShadows;
+	if (cull)
+		cullStats.reset();
+
+	const WorldSnapshot& state = world();
+	const std::vector<ControlPoint>& points = *state.points;
+
 	// Draw the control points
 	// don't draw the control points if you're driving 
 	// (otherwise you get sea-sick as you drive through them)
 	if (!tw->trainCam->value()) {
-		for (size_t i = 0; i < m_pTrack->points.size(); ++i) {
+		for (size_t i = 0; i < points.size(); ++i) {
+			// the cube and the point on top of it fit in this box
+			const Pnt3f& p = points[i].pos;
+			if (cull && !frustum.boxVisible(p - Pnt3f(6, 6, 6), p + Pnt3f(6, 6, 6))) {
+				cullStats.objectsCulled++;
+				continue;
+			}
+			if (cull) cullStats.objectsDrawn++;
+
 			if (!doingShadows) {
 				if (((int)i) != selectedCube)
 					glColor3ub(240, 60, 60);
 				else
 					glColor3ub(240, 240, 30);
 			}
-			m_pTrack->points[i].draw();
+			points[i].draw();
 		}
 	}
 	// draw the track
@@ -395,90 +561,26 @@ void TrainView::drawStuff(bool doingShadows)
 	// TODO: 
 	// call your own track drawing code
 	//####################################################################
-
-	for (int i = 0; i < m_pTrack->points.size(); ++i) {
-
-		Pnt3f cp_pos_p0;
-		if (i == 0) {
-			cp_pos_p0 = m_pTrack->points[(m_pTrack->points.size() - 1)].pos;
-		}
-		else {
-			cp_pos_p0 = m_pTrack->points[(i-1)].pos;
-		}
-		Pnt3f cp_pos_p1 = m_pTrack->points[i].pos;
-		Pnt3f cp_pos_p2 = m_pTrack->points[(i + 1) % m_pTrack->points.size()].pos;
-		Pnt3f cp_pos_p3 = m_pTrack->points[(i + 2) % m_pTrack->points.size()].pos;
-
-		Pnt3f cp_orient_p1 = m_pTrack->points[i].orient;
-		Pnt3f cp_orient_p2 = m_pTrack->points[(i + 1) % m_pTrack->points.size()].orient;
-
-
-		float percent = 1.0f / DIVIDE_LINE;
-		float t = 0;
-		Pnt3f qt = (1 - t) * cp_pos_p1 + t * cp_pos_p2;
-
-		Vector4 G = {};
-		Matrix4 M = {};
-
-
-		Pnt3f qt0;
-		Pnt3f qt1;
-		Pnt3f orient_t;
-
-		
-
-		for (size_t j = 0; j < DIVIDE_LINE; j++) {
-			qt0 = qt;
-
-			int spline_type = tw->splineBrowser->value();
-			switch (spline_type)
-			{
-				//linear
-			case 1:
-				orient_t = (1 - t) * cp_orient_p1 + t * cp_orient_p2;
-				break;
-				//Cardinal Cubic
-			case 2:
-				break;
-				//Cubic B spline
-			case 3:
-
-				break;
-			default:
-				break;
-			}
-
-			t += percent;
-			switch (spline_type) {
-				//linear
-			case 1:
-				qt = (1 - t) * cp_pos_p1 + t * cp_pos_p2;
-				break;
-				//Cardinal Cubic
-			case 2:
-				break;
-				//Cubic B spline
-			case 3:
-
-				break;
-			default:
-				break;
-			}
-
-
-			qt1 = qt;
-
-			glLineWidth(3);
-			glBegin(GL_LINES);
-			if (!doingShadows) {
-				glColor3ub(32, 32, 64);
-			}
-			glVertex3f(qt0.x, qt0.y, qt0.z);
-			glVertex3f(qt1.x, qt1.y, qt1.z);
-
-			glEnd();
-			glLineWidth(1);
-		}
+	// on the GPU, the points are all there is to send
+	if (tw->gpuTrack->value() && gpuSpline.valid()) {
+		gpuSpline.update(points, state.trackVersion);
+		int np = gpuSpline.draw(state.splineType, w(), h(), doingShadows);
+		if (cull)
+			cullStats.gpuPatches = np;
+	}
+	else
+		drawCurve(*state.curve, trackMesh, cull, doingShadows);
+
+	// the branches of the network (on the GPU or not, these are sampled
+	// on the CPU) - edge 0 is the loop, done just above
+	const TrackNetwork* network = state.network.get();
+	size_t branches = network && !network->edges.empty() ? network->edges.size() - 1 : 0;
+	if (branchMeshes.size() != branches)
+		branchMeshes.resize(branches);
+	for (size_t b = 0; b < branches; ++b) {
+		const std::shared_ptr<const TrackCurve>& curve = network->edges[b + 1].curve;
+		if (curve)
+			drawCurve(*curve, branchMeshes[b], cull, doingShadows);
 	}
 
 
@@ -491,28 +593,52 @@ void TrainView::drawStuff(bool doingShadows)
 	// TODO: 
 	//	call your own train drawing code
 	//####################################################################
-	if (!tw->trainCam->value()) {
-		int p1 = m_pTrack->trainU / 1;
-		int p2 = (p1 + 1) % m_pTrack->points.size();
-
-		float t = m_pTrack->trainU - p1;
-
-		Pnt3f qt = (1 - t) * m_pTrack->points[p1].pos + t * m_pTrack->points[p2].pos;
-
-		glBegin(GL_QUADS);
-		glColor3f(100, 200, 150);
-		glTexCoord2f(0.0f, 0.0f);
-		glVertex3f(qt.x - 5, qt.y - 5, qt.z - 5);
-		glTexCoord2f(1.0f, 0.0f);
-		glVertex3f(qt.x + 5, qt.y - 5, qt.z - 5);
-		glTexCoord2f(1.0f, 1.0f);
-		glVertex3f(qt.x + 5, qt.y + 5, qt.z - 5);
-		glTexCoord2f(0.0f, 1.0f);
-		glVertex3f(qt.x - 5, qt.y + 5, qt.z - 5);
+	// the cars are spaced out by arc length behind the front of the train -
+	// back along the network, so they follow it round a switch - and all of
+	// their frames are looked up together
+	if (!tw->trainCam->value() && network && state.curve->length > 0) {
+		int n = (int)tw->cars->value();
+		if (n < 1) n = 1;
+		if (n > maxCars) n = maxCars;
+
+		TrackNetwork::Place head = state.trainPlace(frameTime);
+		TrackNetwork::Place places[maxCars];
+		for (int i = 0; i < n; ++i) {
+			places[i] = head;
+			network->move(places[i], -(carLength / 2 + i * (carLength + carGap)));
+		}
+		Pnt3f pos[maxCars], tangent[maxCars], up[maxCars];
+		network->frames(places, n, pos, tangent, up);
+
+		for (int i = 0; i < n; ++i) {
+			float r = carLength / 2 + 3;
+			if (cull && !frustum.boxVisible(pos[i] - Pnt3f(r, r, r), pos[i] + Pnt3f(r, r, r))) {
+				cullStats.objectsCulled++;
+				continue;
+			}
+			if (cull) cullStats.objectsDrawn++;
+
+			if (!doingShadows) {
+				if (i == 0)
+					glColor3ub(60, 160, 120);
+				else
+					glColor3ub(90, 120, 200);
+			}
+			drawCar(pos[i], tangent[i], up[i]);
+		}
+
+		// couplers, from the back of each car to the front of the next
+		if (!doingShadows)
+			glColor3ub(40, 40, 40);
+		glBegin(GL_LINES);
+		for (int i = 0; i + 1 < n; ++i) {
+			Pnt3f a = pos[i] - tangent[i] * (carLength / 2) + up[i] * 1.5f;
+			Pnt3f b = pos[i + 1] + tangent[i + 1] * (carLength / 2) + up[i + 1] * 1.5f;
+			glVertex3f(a.x, a.y, a.z);
+			glVertex3f(b.x, b.y, b.z);
+		}
 		glEnd();
 	}
-	
-
 
 #ifdef EXAMPLE_SOLUTION
 	// don't draw the train if you're looking out the front window
@@ -521,6 +647,88 @@ void TrainView::drawStuff(bool doingShadows)
 #endif
 }
 
+//************************************************************************
+//
+// * the level of detail goes by how big a chunk is on the screen. the
+//   shadow map is fairly coarse, so it gets the flat rails
+//========================================================================
+void TrainView::
+drawCurve(const TrackCurve& curve, TrackMesh& mesh, bool cull, bool doingShadows)
+//========================================================================
+{
+	if (!mesh.current(curve))
+		mesh.reset(curve);
+
+	Pnt3f reach(mesh.reach(), mesh.reach(), mesh.reach());
+	for (size_t i = 0; i < curve.chunks.size(); ++i) {
+		const TrackCurve::Chunk& c = curve.chunks[i];
+		int level = 1;
+		if (cull) {
+			Pnt3f lo = c.lo - reach;
+			Pnt3f hi = c.hi + reach;
+			if (!frustum.boxVisible(lo, hi)) {
+				cullStats.chunksCulled++;
+				continue;
+			}
+			Pnt3f d = hi - lo;
+			float radius = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z) / 2;
+			level = mesh.pickLevel((int)i, frustum.pixelSize((lo + hi) * .5f, radius, h()));
+		}
+
+		int nv = mesh.draw(curve, (int)i, level, doingShadows);
+		if (cull) {
+			cullStats.chunksDrawn++;
+			cullStats.chunksAtLevel[level]++;
+			cullStats.trackVertices += nv;
+		}
+	}
+}
+
+//************************************************************************
+//
+// * a box 5 wide and 4 tall, carLength long, built on the frame of the
+//   track (side is tangent x up)
+//========================================================================
+void TrainView::
+drawCar(const Pnt3f& pos, const Pnt3f& tangent, const Pnt3f& up)
+//========================================================================
+{
+	Pnt3f side = tangent * up;
+	Pnt3f f = tangent * (carLength / 2);
+	Pnt3f s = side * 2.5f;
+	Pnt3f b = pos + up * .5f;		// on top of the rails
+	Pnt3f t = b + up * 4;
+
+	// the corners: back/front, left/right, bottom/top
+	Pnt3f c[8] = {
+		b - f - s, b - f + s, b + f - s, b + f + s,
+		t - f - s, t - f + s, t + f - s, t + f + s
+	};
+
+	// each face, counter-clockwise from outside, and its normal
+	static const int faces[6][4] = {
+		{ 0, 2, 3, 1 },		// bottom
+		{ 4, 5, 7, 6 },		// top
+		{ 0, 1, 5, 4 },		// back
+		{ 2, 6, 7, 3 },		// front
+		{ 0, 4, 6, 2 },		// left
+		{ 1, 3, 7, 5 }		// right
+	};
+	Pnt3f normals[6] = {
+		up * -1.f, up, tangent * -1.f, tangent, side * -1.f, side
+	};
+
+	glBegin(GL_QUADS);
+	for (int i = 0; i < 6; ++i) {
+		glNormal3f(normals[i].x, normals[i].y, normals[i].z);
+		for (int j = 0; j < 4; ++j) {
+			const Pnt3f& p = c[faces[i][j]];
+			glVertex3f(p.x, p.y, p.z);
+		}
+	}
+	glEnd();
+}
+
 // 
 //************************************************************************
 //
@@ -567,9 +775,10 @@ doPick()
 	glPushName(0);
 
 	// draw the cubes, loading the names as we go
-	for (size_t i = 0; i < m_pTrack->points.size(); ++i) {
+	const std::vector<ControlPoint>& points = *world().points;
+	for (size_t i = 0; i < points.size(); ++i) {
 		glLoadName((GLuint)(i + 1));
-		m_pTrack->points[i].draw();
+		points[i].draw();
 	}
 
 	// go back to drawing mode, and see how picking did
@@ -16,9 +16,9 @@
 						You might want to modify this class to add new widgets
 						for controlling	your train
 
-						This takes care of lots of things - including installing 
-						itself into the FlTk "idle" loop so that we get periodic 
-						updates (if we're running the train).
+						This takes care of lots of things - including starting
+						the simulation thread, which owns the track and the
+						train (the widgets post it commands).
 
 
      Platform:    Visio Studio.Net 2003/2005
@@ -27,13 +27,17 @@
 
 #include <FL/fl.h>
 #include <FL/Fl_Box.h>
-
-// for using the real time clock
-#include <time.h>
+#include <FL/fl_ask.h>
 
 #include "TrainWindow.H"
 #include "TrainView.H"
 #include "CallBacks.H"
+#include "Journal.H"
+#include "TrackCache.H"
+
+// where the edits are kept until they are saved (TrackEdits.1.journal, or
+// .2 if another copy of the program has that one...)
+static const char* journalBase = "TrackEdits";
 
 
 
@@ -53,7 +57,6 @@ TrainWindow(const int x, const int y)
 
 		trainView = new TrainView(5,5,590,590);
 		trainView->tw = this;
-		trainView->m_pTrack = &m_Track;
 		this->resizable(trainView);
 
 		// to make resizing work better, put all the widgets in a group
@@ -62,6 +65,7 @@ TrainWindow(const int x, const int y)
 
 		runButton = new Fl_Button(605,pty,60,20,"Run");
 		togglify(runButton);
+		runButton->callback((Fl_Callback*)runButtonCB,this);
 
 		Fl_Button* fb = new Fl_Button(700,pty,25,20,"@>>");
 		fb->callback((Fl_Callback*)forwCB,this);
@@ -77,6 +81,16 @@ TrainWindow(const int x, const int y)
 		speed->value(2);
 		speed->align(FL_ALIGN_LEFT);
 		speed->type(FL_HORIZONTAL);
+		speed->callback((Fl_Callback*)speedCB,this);
+
+		pty+=25;
+		cars = new Fl_Value_Slider(655,pty,140,20,"cars");
+		cars->range(1,TrainView::maxCars);
+		cars->step(1);
+		cars->value(3);
+		cars->align(FL_ALIGN_LEFT);
+		cars->type(FL_HORIZONTAL);
+		cars->callback((Fl_Callback*)damageCB,this);
 
 		pty += 30;
 
@@ -106,12 +120,23 @@ TrainWindow(const int x, const int y)
 		// TODO: make sure these choices are the same as what the code supports
 		splineBrowser = new Fl_Browser(605,pty,120,75,"Spline Type");
 		splineBrowser->type(2);		// select
-		splineBrowser->callback((Fl_Callback*)damageCB,this);
+		splineBrowser->callback((Fl_Callback*)splineCB,this);
 		splineBrowser->add("Linear");
 		splineBrowser->add("Cardinal Cubic");
 		splineBrowser->add("Cubic B-Spline");
 		splineBrowser->select(2);
 
+		gpuTrack = new Fl_Button(730,pty,65,20,"GPU");
+		togglify(gpuTrack);
+
+		physics = new Fl_Button(730,pty+25,65,20,"Physics");
+		togglify(physics);
+		physics->callback((Fl_Callback*)physicsCB,this);
+
+		plan = new Fl_Button(730,pty+50,65,20,"Plan");
+		togglify(plan);
+		plan->callback((Fl_Callback*)planCB,this);
+
 		pty += 110;
 
 		// add and delete points
@@ -140,8 +165,52 @@ TrainWindow(const int x, const int y)
 		Fl_Button* rzp = new Fl_Button(700,pty,30,20,"R-Z");
 		rzp->callback((Fl_Callback*)rmzCB,this);
 
+		record = new Fl_Button(735,pty,60,20,"Rec");
+		togglify(record);
+		record->callback((Fl_Callback*)recordCB,this);
+
+		pty += 25;
+		// another way round, and the switch onto it
+		Fl_Button* branchb = new Fl_Button(605,pty,60,20,"Branch");
+		branchb->callback((Fl_Callback*)branchCB,this);
+		Fl_Button* switchb = new Fl_Button(670,pty,60,20,"Switch");
+		switchb->callback((Fl_Callback*)switchCB,this);
+
 		pty+=30;
 
+		// shadow map resolution and filter size
+		shadowSize = new Fl_Choice(690,pty,105,20,"Shadow Map");
+		shadowSize->add("512|1024|2048|4096");
+		shadowSize->value(2);
+		shadowSize->callback((Fl_Callback*)shadowCB,this);
+
+		pty+=25;
+		pcfRadius = new Fl_Value_Slider(655,pty,140,20,"PCF");
+		pcfRadius->range(0,ShadowMap::maxPcfRadius);
+		pcfRadius->step(1);
+		pcfRadius->value(1);
+		pcfRadius->align(FL_ALIGN_LEFT);
+		pcfRadius->type(FL_HORIZONTAL);
+		pcfRadius->callback((Fl_Callback*)shadowCB,this);
+
+		pty+=25;
+		cullInfo = new Fl_Box(605,pty,190,105);
+		cullInfo->align(FL_ALIGN_INSIDE | FL_ALIGN_LEFT);
+		cullInfo->labelsize(12);
+
+		pty+=110;
+
+		ioProgress = new Fl_Progress(605,pty,125,20);
+		ioProgress->minimum(0);
+		ioProgress->maximum(1);
+		ioProgress->selection_color((Fl_Color)3);
+		ioProgress->hide();
+		ioCancel = new Fl_Button(735,pty,60,20,"Cancel");
+		ioCancel->callback((Fl_Callback*)cancelIOCB,this);
+		ioCancel->hide();
+
+		pty+=25;
+
 		// TODO: add widgets for all of your fancier features here
 #ifdef EXAMPLE_SOLUTION
 		makeExampleWidgets(this,pty);
@@ -155,8 +224,42 @@ TrainWindow(const int x, const int y)
 	}
 	end();	// done adding to this widget
 
-	// set up callback on idle
-	Fl::add_idle((void (*)(void*))runButtonCB,this);
+	// take the first snapshot (the simulation makes it right away), tell
+	// the simulation what the widgets start out saying, then let it go
+	simulation.fetch();
+	simulation.post(Simulation::Command(Simulation::Command::SetSpeed, 0,
+										(float)speed->value()));
+	simulation.post(Simulation::Command(Simulation::Command::SetSplineType,
+										splineBrowser->value()));
+
+	// keep a journal of the edits - and if a run didn't end properly, its
+	// journal is still there: do its edits again, on the same track file
+	std::vector<Simulation::Command> recovered;
+	bool journaling = journalLock.claim(journalBase);
+	bool recovering = journaling && recoverJournal(journalLock.file().c_str(), recovered);
+	if (journaling) {
+		Simulation::Command journal(Simulation::Command::KeepJournal, 0, 1);
+		journal.name = journalLock.file();
+		simulation.post(journal);
+	}
+	std::string track;
+	for (size_t i = 0; i < recovered.size(); ++i) {
+		simulation.post(recovered[i]);
+		if (recovered[i].kind == Simulation::Command::SetPoints)
+			track = curveCacheTrack(recovered[i].name.c_str());
+	}
+
+	simulation.start((void (*)(void*))simulationCB, this);
+	io.setNotify((void (*)(void*))ioNotifyCB, this);
+	watch.setNotify((void (*)(void*))watchNotifyCB, this);
+	if (!track.empty())
+		watch.watch(track.c_str());
+	if (recovering)
+		fl_alert("The last session didn't finish - its %d unsaved edits are back",
+				 (int)recovered.size() - 1);
+	else if (!journaling)
+		fl_alert("Too many copies of the program are running here - "
+				 "edits won't be kept if this one crashes");
 }
 
 //************************************************************************
@@ -181,41 +284,8 @@ void TrainWindow::
 damageMe()
 //========================================================================
 {
-	if (trainView->selectedCube >= ((int)m_Track.points.size()))
+	const WorldSnapshot& world = simulation.snapshot();
+	if (world.points && trainView->selectedCube >= ((int)world.points->size()))
 		trainView->selectedCube = 0;
 	trainView->damage(1);
 }
-
-//************************************************************************
-//
-// * This will get called (approximately) 30 times per second
-//   if the run button is pressed
-//========================================================================
-void TrainWindow::
-advanceTrain(float dir)
-//========================================================================
-{
-	//#####################################################################
-	// TODO: make this work for your train
-	//#####################################################################
-	trainView->m_pTrack->trainU += 0.01;
-	if (trainView->m_pTrack->trainU >= trainView->m_pTrack->points.size()) {
-		trainView->m_pTrack->trainU -= trainView->m_pTrack->points.size();
-	}
-
-#ifdef EXAMPLE_SOLUTION
-	// note - we give a little bit more example code here than normal,
-	// so you can see how this works
-
-	if (arcLength->value()) {
-		float vel = ew.physics->value() ? physicsSpeed(this) : dir * (float)speed->value();
-		world.trainU += arclenVtoV(world.trainU, vel, this);
-	} else {
-		world.trainU +=  dir * ((float)speed->value() * .1f);
-	}
-
-	float nct = static_cast<float>(world.points.size());
-	if (world.trainU > nct) world.trainU -= nct;
-	if (world.trainU < 0) world.trainU += nct;
-#endif
-}
\ No newline at end of file
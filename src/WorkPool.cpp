@@ -0,0 +1,207 @@
+/************************************************************************
+     File:        WorkPool.cpp
+
+     Comment:     A pool of threads for parallel loops, with work stealing
+
+     Platform:    Visio Studio.Net 2003/2005
+
+*************************************************************************/
+
+#include "WorkPool.H"
+
+static inline unsigned long long pack(size_t begin, size_t end)
+{
+	return ((unsigned long long)end << 32) | (unsigned long long)begin;
+}
+static inline size_t first(unsigned long long r) { return (size_t)(r & 0xffffffffu); }
+static inline size_t last(unsigned long long r) { return (size_t)(r >> 32); }
+
+//****************************************************************************
+//
+// * Constructor
+//============================================================================
+WorkPool::
+WorkPool(int threads)
+	: steals(0), nThreads(threads), body(0), n(0), grain(1), left(0), busy(0),
+	  generation(0), quit(false)
+//============================================================================
+{
+	if (nThreads <= 0)
+		nThreads = (int)std::thread::hardware_concurrency();
+	if (nThreads <= 0)
+		nThreads = 1;
+	slots = std::vector<Slot>(nThreads);
+	for (int i = 0; i < nThreads; ++i)
+		slots[i].range = 0;
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+WorkPool::
+~WorkPool()
+//============================================================================
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeup.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+//****************************************************************************
+//
+// * the caller is thread 0, so there is one fewer to start
+//============================================================================
+void WorkPool::
+start()
+//============================================================================
+{
+	for (int i = 1; i < nThreads; ++i)
+		threads.push_back(std::thread([this, i] {
+			unsigned long seen = 0;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wakeup.wait(lock, [this, seen] { return quit || generation != seen; });
+					if (quit)
+						return;
+					seen = generation;
+				}
+				work(i);
+				if (busy.fetch_sub(1) == 1) {
+					std::lock_guard<std::mutex> lock(mutex);
+					done.notify_one();
+				}
+			}
+		}));
+}
+
+//****************************************************************************
+//
+// *
+//============================================================================
+void WorkPool::
+parallelFor(size_t _n, size_t _grain, const std::function<void(size_t, size_t)>& _body)
+//============================================================================
+{
+	if (!_n)
+		return;
+	if (_grain < 1)
+		_grain = 1;
+	size_t pieces = (_n + _grain - 1) / _grain;
+
+	// not worth waking anybody up for
+	if (pieces == 1 || nThreads == 1) {
+		for (size_t b = 0; b < _n; b += _grain)
+			_body(b, (b + _grain < _n) ? b + _grain : _n);
+		return;
+	}
+
+	if (threads.empty())
+		start();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		body = &_body;
+		n = _n;
+		grain = _grain;
+		for (int i = 0; i < nThreads; ++i)
+			slots[i].range = pack(pieces * i / nThreads, pieces * (i + 1) / nThreads);
+		left = pieces;
+		busy = nThreads;
+		++generation;
+	}
+	wakeup.notify_all();
+
+	work(0);
+	busy.fetch_sub(1);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busy == 0; });
+	body = 0;
+}
+
+//****************************************************************************
+//
+// * do pieces - our own first, then anybody's - until there are none left
+//   to start. some may still be running on other threads when this returns
+//============================================================================
+void WorkPool::
+work(int self)
+//============================================================================
+{
+	for (;;) {
+		size_t piece;
+		if (take(self, piece)) {
+			size_t b = piece * grain;
+			size_t e = (b + grain < n) ? b + grain : n;
+			(*body)(b, e);
+			left.fetch_sub(1);
+		}
+		else if (left == 0)
+			return;
+		else if (!steal(self))
+			std::this_thread::yield();
+	}
+}
+
+//****************************************************************************
+//
+// * the next piece from the front of our own range
+//============================================================================
+bool WorkPool::
+take(int self, size_t& piece)
+//============================================================================
+{
+	std::atomic<unsigned long long>& r = slots[self].range;
+	unsigned long long v = r.load();
+	for (;;) {
+		size_t b = first(v), e = last(v);
+		if (b >= e)
+			return false;
+		if (r.compare_exchange_weak(v, pack(b + 1, e))) {
+			piece = b;
+			return true;
+		}
+	}
+}
+
+//****************************************************************************
+//
+// * take the back half of the biggest range there is and make it ours.
+//   our own range is empty (or we wouldn't be here), so nobody else
+//   touches it until we put something in it
+//============================================================================
+bool WorkPool::
+steal(int self)
+//============================================================================
+{
+	int victim = -1;
+	size_t most = 0;
+	unsigned long long v = 0;
+	for (int i = 0; i < nThreads; ++i) {
+		if (i == self)
+			continue;
+		unsigned long long r = slots[i].range.load();
+		if (first(r) < last(r) && last(r) - first(r) > most) {
+			most = last(r) - first(r);
+			victim = i;
+			v = r;
+		}
+	}
+	if (victim < 0)
+		return false;
+
+	size_t b = first(v), e = last(v);
+	size_t k = (e - b + 1) / 2;
+	if (!slots[victim].range.compare_exchange_strong(v, pack(b, e - k)))
+		return false;
+
+	slots[self].range = pack(e - k, e);
+	steals += k;
+	return true;
+}
@@ -23,7 +23,20 @@
 *************************************************************************/
 
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
 #include "TrainWindow.H"
+#include "Fleet.H"
+#include "BlockSignals.H"
+#include "TrackNetwork.H"
+#include "Recorder.H"
+#include "Headless.H"
+#include "GpuCheck.H"
+#include "TrackFile.H"
+#include "TrackArchive.H"
+#include "TrackCache.H"
+#include "TrackExport.H"
+#include "TrackImport.H"
 
 #pragma warning(push)
 #pragma warning(disable:4312)
@@ -32,11 +45,154 @@
 #pragma warning(pop)
 
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
+	// "-fleet" just times the simulation of lots of trains, no window
+	if (argc > 1 && !strcmp(argv[1], "-fleet")) {
+		benchmarkFleet();
+		return 0;
+	}
+	// "-signals [trains]" runs trains around under block signals and
+	// reports how many riders that moves
+	if (argc > 1 && !strcmp(argv[1], "-signals")) {
+		reportSignals(argc > 2 ? (size_t)atoi(argv[2]) : 4);
+		return 0;
+	}
+	// "-network [trains]" runs trains round a track with a bypass
+	if (argc > 1 && !strcmp(argv[1], "-network")) {
+		reportNetwork(argc > 2 ? (size_t)atoi(argv[2]) : 1000);
+		return 0;
+	}
+	// "-replay file [step]" plays a recording back, as fast as it can
+	if (argc > 2 && !strcmp(argv[1], "-replay")) {
+		reportReplay(argv[2], argc > 3 ? strtoul(argv[3], 0, 10) : 0);
+		return 0;
+	}
+	// "-trackfiles [points]" times loading the text and binary track files
+	if (argc > 1 && !strcmp(argv[1], "-trackfiles")) {
+		reportTrackFiles(argc > 2 ? (size_t)atoi(argv[2]) : 65535);
+		return 0;
+	}
+	// "-curvecache [points]" times reading a curve from its sidecar
+	if (argc > 1 && !strcmp(argv[1], "-curvecache")) {
+		reportCurveCache(argc > 2 ? (size_t)atoi(argv[2]) : 20000);
+		return 0;
+	}
+	// "-archive [revisions] [points]" times a compressed archive of revisions
+	if (argc > 1 && !strcmp(argv[1], "-archive")) {
+		reportArchive(argc > 2 ? (size_t)atoi(argv[2]) : 2000,
+					  argc > 3 ? (size_t)atoi(argv[3]) : 1000);
+		return 0;
+	}
+	// "-export track.txt out.obj|out.ply|out.gltf [-spline type] [-samples n]"
+	// writes the track's geometry out for other programs (more samples per
+	// segment make a finer - and much bigger - mesh)
+	if (argc > 3 && !strcmp(argv[1], "-export")) {
+		int type = TrackCurve::Cardinal;
+		int samples = 100;
+		for (int i = 4; i + 1 < argc; ++i) {
+			if (!strcmp(argv[i], "-spline"))
+				type = atoi(argv[++i]);
+			else if (!strcmp(argv[i], "-samples"))
+				samples = atoi(argv[++i]);
+		}
+		return reportExport(argv[2], argv[3], type, samples) ? 0 : 1;
+	}
+	// "-import survey.csv track.txt [-columns east north up] [-origin e n u]
+	// [-scale s] [-rotate degrees] [-tolerance t] [-points n]" fits a track
+	// to a surveyed centerline (the columns count from 0; the origin is the
+	// first row unless it is given)
+	if (argc > 3 && !strcmp(argv[1], "-import")) {
+		ImportOptions options;
+		for (int i = 4; i < argc; ++i) {
+			bool more = i + 1 < argc;
+			if (i + 3 < argc && !strcmp(argv[i], "-columns")) {
+				for (int k = 0; k < 3; ++k)
+					options.columns[k] = atoi(argv[++i]);
+			}
+			else if (i + 3 < argc && !strcmp(argv[i], "-origin")) {
+				for (int k = 0; k < 3; ++k)
+					options.origin[k] = atof(argv[++i]);
+				options.autoOrigin = false;
+			}
+			else if (more && !strcmp(argv[i], "-scale"))
+				options.scale = atof(argv[++i]);
+			else if (more && !strcmp(argv[i], "-rotate"))
+				options.rotate = atof(argv[++i]);
+			else if (more && !strcmp(argv[i], "-tolerance"))
+				options.tolerance = (float)atof(argv[++i]);
+			else if (more && !strcmp(argv[i], "-points"))
+				options.maxPoints = (size_t)atoi(argv[++i]);
+			else {
+				printf("don't know what %s is\n", argv[i]);
+				return 2;
+			}
+		}
+		return reportImport(argv[2], argv[3], options) ? 0 : 1;
+	}
+	// "-gpucheck [track.txt] [-tolerance t]" checks the rails made on the
+	// GPU against the CPU's, for each spline type - it fails if any of them
+	// is more than t (.01 to start with) off, or can't be checked
+	if (argc > 1 && !strcmp(argv[1], "-gpucheck")) {
+		const char* filename = 0;
+		float tolerance = .01f;
+		for (int i = 2; i < argc; ++i) {
+			if (i + 1 < argc && !strcmp(argv[i], "-tolerance"))
+				tolerance = (float)atof(argv[++i]);
+			else if (!filename && argv[i][0] != '-')
+				filename = argv[i];
+			else {
+				printf("don't know what %s is\n", argv[i]);
+				return 2;
+			}
+		}
+		return reportGpuCheck(filename, tolerance) ? 0 : 1;
+	}
+	// "-run track.txt [-laps n] [-ticks n] [-physics | -plan] [-speed v]
+	// [-spline type] [-sidecar]" rides the track with no window and says
+	// what the riders felt - it fails (for scripts) if the train doesn't
+	// make the laps. -sidecar keeps a big track's curve next to it
+	// (TrackCache) for the next run
+	if (argc > 2 && !strcmp(argv[1], "-run")) {
+		Headless h;
+		for (int i = 3; i < argc; ++i) {
+			bool more = i + 1 < argc;
+			if (!strcmp(argv[i], "-physics"))
+				h.mode = Headless::Coast;
+			else if (!strcmp(argv[i], "-plan"))
+				h.mode = Headless::Planned;
+			else if (more && !strcmp(argv[i], "-laps"))
+				h.laps = strtoul(argv[++i], 0, 10);
+			else if (more && !strcmp(argv[i], "-ticks"))
+				h.maxTicks = strtoul(argv[++i], 0, 10);
+			else if (more && !strcmp(argv[i], "-speed"))
+				h.speed = (float)atof(argv[++i]);
+			else if (more && !strcmp(argv[i], "-spline"))
+				h.splineType = atoi(argv[++i]);
+			else if (!strcmp(argv[i], "-sidecar"))
+				h.sidecar = true;
+			else {
+				printf("don't know what %s is\n", argv[i]);
+				return 2;
+			}
+		}
+		return h.run(argv[2]) ? 0 : 1;
+	}
+
+	// none of those - it is the window (the reports above don't start
+	// with the banner, so scripts can read them as they are)
 	printf("CS559 Train Assignment\n");
 
+	// the simulation runs on its own thread and wakes us up with
+	// Fl::awake - which needs FlTk's locking turned on first
+	Fl::lock();
+
+	// "-sidecars" keeps the curves of big tracks that are loaded next to
+	// them (TrackCache), so they load quicker the next time
 	TrainWindow tw;
+	for (int i = 1; i < argc; ++i)
+		if (!strcmp(argv[i], "-sidecars"))
+			tw.simulation.writeSidecars = true;
 	tw.show();
 
 	Fl::run();